@@ -0,0 +1,244 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "AsyncHandler.hpp"
+
+
+MoveDetect::AsyncHandler::AsyncHandler(const size_t queue_size) :
+	AsyncHandler(Handler(), queue_size)
+{
+	return;
+}
+
+
+MoveDetect::AsyncHandler::AsyncHandler(const Handler & configuration, const size_t queue_size) :
+	detector(configuration),
+	colour_balance_next_frame(0),
+	next_frame_index(0),
+	started(false),
+	thumbnail_queue(std::max<size_t>(1, queue_size)),
+	detect_queue(std::max<size_t>(1, queue_size)),
+	outstanding_jobs(0)
+{
+	start();
+
+	return;
+}
+
+
+MoveDetect::AsyncHandler::~AsyncHandler()
+{
+	try
+	{
+		wait();
+	}
+	catch (...)
+	{
+		// nothing we can do about callback exceptions at this point
+	}
+
+	// closing the first queue causes the first stage to close the second queue once it is done
+	thumbnail_queue.close();
+	thumbnail_thread.join();
+	detect_thread.join();
+
+	return;
+}
+
+
+void MoveDetect::AsyncHandler::start()
+{
+	thumbnail_thread	= std::thread(&AsyncHandler::run_thumbnails, this);
+	detect_thread		= std::thread(&AsyncHandler::run_detect, this);
+
+	return;
+}
+
+
+MoveDetect::Handler & MoveDetect::AsyncHandler::handler()
+{
+	return detector;
+}
+
+
+std::future<MoveDetect::Result> MoveDetect::AsyncHandler::submit(const cv::Mat & frame)
+{
+	std::unique_ptr<Job> job(new Job);
+	job->frame = frame;
+	std::future<Result> future = job->promise.get_future();
+
+	enqueue(std::move(job));
+
+	return future;
+}
+
+
+void MoveDetect::AsyncHandler::submit(const cv::Mat & frame, Callback callback)
+{
+	if (not callback)
+	{
+		throw std::invalid_argument("callback cannot be empty");
+	}
+
+	std::unique_ptr<Job> job(new Job);
+	job->frame		= frame;
+	job->callback	= callback;
+
+	enqueue(std::move(job));
+
+	return;
+}
+
+
+void MoveDetect::AsyncHandler::wait()
+{
+	std::unique_lock<std::mutex> guard(idle_lock);
+	idle.wait(guard, [&]{ return outstanding_jobs == 0; });
+
+	if (callback_exception)
+	{
+		std::exception_ptr ptr = callback_exception;
+		callback_exception = nullptr;
+		std::rethrow_exception(ptr);
+	}
+
+	return;
+}
+
+
+void MoveDetect::AsyncHandler::enqueue(std::unique_ptr<Job> job)
+{
+	if (job->frame.empty())
+	{
+		throw std::invalid_argument("cannot submit an empty frame");
+	}
+
+	if (started == false)
+	{
+		// Neither stage has seen a frame yet, so this is the only time the configuration can safely be copied.  The
+		// first stage only ever reads from its own copy, which is published to it by the queue.
+		thumbnailer			= detector;
+		next_frame_index	= detector.next_frame_index;
+		started				= true;
+	}
+
+	job->frame_index = next_frame_index ++;
+
+	{
+		std::lock_guard<std::mutex> guard(idle_lock);
+		outstanding_jobs ++;
+	}
+
+	thumbnail_queue.push(std::move(job));
+
+	return;
+}
+
+
+void MoveDetect::AsyncHandler::run_thumbnails()
+{
+	std::unique_ptr<Job> job;
+	while (thumbnail_queue.pop(job))
+	{
+		try
+		{
+			// same colour balancing rules as Handler::detect(), but using our own lookup table
+			cv::Mat lut;
+			const cv::Mat & frame = job->frame;
+			if (thumbnailer.colour_balance_enabled and (frame.depth() == CV_8U and (frame.channels() == 1 or frame.channels() == 3)))
+			{
+				if (colour_balance_lut.empty() or colour_balance_lut.channels() != frame.channels() or job->frame_index >= colour_balance_next_frame)
+				{
+					colour_balance_lut			= simple_colour_balance_lut(frame);
+					colour_balance_next_frame	= job->frame_index + std::max<size_t>(1, thumbnailer.colour_balance_frequency);
+				}
+				lut = colour_balance_lut;
+			}
+
+			job->thumbnail = thumbnailer.create_thumbnail(frame, lut);
+		}
+		catch (...)
+		{
+			job->exception = std::current_exception();
+		}
+
+		detect_queue.push(std::move(job));
+	}
+
+	detect_queue.close();
+
+	return;
+}
+
+
+void MoveDetect::AsyncHandler::run_detect()
+{
+	std::unique_ptr<Job> job;
+	while (detect_queue.pop(job))
+	{
+		Result result;
+		std::exception_ptr exception = job->exception;
+		if (exception == nullptr)
+		{
+			try
+			{
+				detector.detect(job->frame_index, job->frame, job->thumbnail);
+
+				result.frame_index			= job->frame_index;
+				result.movement_detected	= detector.movement_detected;
+				result.transition_detected	= detector.transition_detected;
+				result.psnr_score			= detector.most_recent_psnr_score;
+				result.mask					= detector.mask;
+				result.output				= detector.output;
+			}
+			catch (...)
+			{
+				exception = std::current_exception();
+			}
+		}
+
+		if (job->callback)
+		{
+			if (exception == nullptr)
+			{
+				try
+				{
+					job->callback(result);
+				}
+				catch (...)
+				{
+					exception = std::current_exception();
+				}
+			}
+
+			if (exception)
+			{
+				std::lock_guard<std::mutex> guard(idle_lock);
+				if (callback_exception == nullptr)
+				{
+					callback_exception = exception;
+				}
+			}
+		}
+		else if (exception)
+		{
+			job->promise.set_exception(exception);
+		}
+		else
+		{
+			job->promise.set_value(result);
+		}
+
+		// release the frame before telling anyone we're done with it
+		job.reset();
+
+		{
+			std::lock_guard<std::mutex> guard(idle_lock);
+			outstanding_jobs --;
+		}
+		idle.notify_all();
+	}
+
+	return;
+}
@@ -0,0 +1,159 @@
+// MoveDetect -- Library to detect whether movement can be detected between two images or video frames.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "MoveDetect.hpp"
+#include "SpscQueue.hpp"
+
+
+namespace MoveDetect
+{
+	/** Process the frames of a single video stream in a pipeline, so the thumbnail of the next frame is created while
+	 * the previous frame is still being compared and masked.
+	 *
+	 * There are two stages, each running on its own thread, and connected by a bounded @ref SpscQueue:
+	 *
+	 * @li The first stage does the colour balancing and resizing to create the thumbnail.  @see @ref Handler::create_thumbnail()
+	 * @li The second stage does everything else, such as the comparison against the control frames and creating the mask.
+	 *
+	 * The frames are always processed and delivered in the order in which they were submitted, so the results, including
+	 * @ref Result::transition_detected, are exactly the same as calling @ref Handler::detect() on each frame in turn.
+	 * The time it takes for each frame is about the same, but more frames can be processed each second on a multi-core
+	 * computer.
+	 *
+	 * ~~~~{.cpp}
+	 * MoveDetect::AsyncHandler async;
+	 * async.handler().mask_enabled = true;
+	 *
+	 * while (video.read(frame))
+	 * {
+	 *     async.submit(frame, [](const MoveDetect::Result & result)
+	 *     {
+	 *         // ...
+	 *     });
+	 *     frame = cv::Mat(); // do not re-use the pixels of a frame which has been submitted
+	 * }
+	 * async.wait();
+	 * ~~~~
+	 *
+	 * @note When @ref Handler::adaptive_enabled is set, the thumbnails of skipped frames are still created, since the
+	 * first stage cannot know ahead of time which frames will be skipped.
+	 */
+	class AsyncHandler
+	{
+		public:
+
+			/// Callback used to deliver the results.  It is called on the thread of the second stage.
+			typedef std::function<void(const Result & result)> Callback;
+
+			/** Constructor.  The threads are started immediately and remain running until the object is destroyed.
+			 *
+			 * @param [in] queue_size The maximum number of frames waiting between the stages.  When the queue is full,
+			 * @ref submit() blocks until there is room, which stops a fast producer from using all the memory.
+			 */
+			AsyncHandler(const size_t queue_size = 8);
+
+			/// Constructor which uses @p configuration as the initial handler.  @see @ref handler()
+			AsyncHandler(const Handler & configuration, const size_t queue_size = 8);
+
+			/// Destructor.  This will wait for all the frames which have been submitted to be processed.
+			virtual ~AsyncHandler();
+
+			/** Access the handler.  The configuration must be set before the first frame is submitted, since it is copied
+			 * for use by the first stage at that time.
+			 *
+			 * @warning Do not access the handler while frames are being processed.  Call @ref wait() first.
+			 */
+			Handler & handler();
+
+			/** Queue the next frame.  The result is returned through a future.  Any exception thrown while processing the
+			 * frame is also returned through the future.
+			 *
+			 * @warning This must always be called from the same thread.
+			 *
+			 * @note The frame is not copied.  The caller must not modify the pixels until the result is available.
+			 */
+			std::future<Result> submit(const cv::Mat & frame);
+
+			/** Queue the next frame.  The result is delivered to @p callback.  If an exception is thrown while processing
+			 * the frame, the callback is not called and the first such exception is rethrown from @ref wait().
+			 *
+			 * @warning This must always be called from the same thread.
+			 *
+			 * @note The frame is not copied.  The caller must not modify the pixels until the callback has been called.
+			 */
+			void submit(const cv::Mat & frame, Callback callback);
+
+			/// Wait until all the frames submitted so far have been processed.
+			void wait();
+
+		private:
+
+			/// A single frame travelling through the pipeline.
+			struct Job
+			{
+				size_t frame_index;
+				cv::Mat frame;
+				cv::Mat thumbnail;
+				std::promise<Result> promise;
+				Callback callback;
+
+				/// Exception thrown by the first stage, which is delivered by the second stage to keep the results in order.
+				std::exception_ptr exception;
+			};
+
+			/// Start the threads.  This is called by both constructors.
+			void start();
+
+			/// Assign the frame index and send the job to the first stage.
+			void enqueue(std::unique_ptr<Job> job);
+
+			/// The first stage:  colour balancing and resizing.
+			void run_thumbnails();
+
+			/// The second stage:  everything else in @ref Handler::detect().
+			void run_detect();
+
+			/// Only used by the second stage once frames have been submitted.
+			Handler detector;
+
+			/// Copy of @ref detector made when the first frame is submitted.  Only used by the first stage.
+			Handler thumbnailer;
+
+			/// Colour balancing lookup table used by the first stage.  @see @ref Handler::colour_balance_enabled
+			cv::Mat colour_balance_lut;
+
+			/// The next frame index where @ref colour_balance_lut needs to be calculated again.
+			size_t colour_balance_next_frame;
+
+			/// Frame index assigned to the next frame submitted.
+			size_t next_frame_index;
+
+			bool started;
+
+			SpscQueue<std::unique_ptr<Job>> thumbnail_queue;
+			SpscQueue<std::unique_ptr<Job>> detect_queue;
+
+			std::thread thumbnail_thread;
+			std::thread detect_thread;
+
+			/// Used to wait for the pipeline to become idle.
+			std::mutex idle_lock;
+			std::condition_variable idle;
+
+			/// Number of frames which have been submitted but not yet delivered.
+			size_t outstanding_jobs;
+
+			/// The first exception thrown when results are delivered through callbacks.
+			std::exception_ptr callback_exception;
+	};
+}
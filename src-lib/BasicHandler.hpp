@@ -0,0 +1,437 @@
+// MoveDetect -- Library to detect whether movement can be detected between two images or video frames.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "MoveDetect.hpp"
+#include "Kernels.hpp"
+
+
+namespace MoveDetect
+{
+	/** Optional stages of @ref BasicHandler, chosen at compile time.  These are bit flags which can be combined.  Any
+	 * stage which is not requested is not compiled in.
+	 */
+	namespace Features
+	{
+		const unsigned int None			= 0;	///< Only decide whether there is movement.
+		const unsigned int Mask			= 1;	///< Create @ref BasicHandler::mask when there is movement.
+		const unsigned int Contours		= 2;	///< Find @ref BasicHandler::contours.  This implies @ref Mask.
+		const unsigned int BoundingBox	= 4;	///< Find @ref BasicHandler::bbox.  This implies @ref Mask.
+	}
+
+	/** The ways @ref BasicHandler can measure the difference between two thumbnails, chosen at compile time.
+	 *
+	 * Each metric provides the same static functions:  @p distance() between two buffers, the @p limit() above which a
+	 * distance means there is movement, the @p score() reported to the caller, and @p first_above() which compares one
+	 * thumbnail against several controls.  @p first_above() always returns the lowest index whose complete distance is
+	 * above the limit, the same as comparing the controls one at a time in order, even when the comparisons are done in
+	 * blocks.  Decisions are always made using the integer distance, never the score.
+	 */
+	namespace Metrics
+	{
+		/** Peak signal to noise ratio, in dB.  This is the same metric used by @ref Handler, where movement is detected
+		 * when the score is below the threshold.  Unlike @ref MoveDetect::psnr(), identical thumbnails have a score of
+		 * infinity and are never reported as movement.
+		 */
+		struct PSNR
+		{
+			static constexpr double default_threshold = 32.0;
+
+			static uint64_t distance(const uint8_t * a, const uint8_t * b, const size_t len)
+			{
+				return Kernels::sse_u8(a, b, len);
+			}
+
+			static uint64_t limit(const double threshold, const size_t values)
+			{
+				return Kernels::sse_limit_from_psnr(threshold, values);
+			}
+
+			static double score(const uint64_t distance, const size_t values)
+			{
+				return (distance == 0 ? std::numeric_limits<double>::infinity() : Kernels::psnr_from_sse(distance, values));
+			}
+
+			static size_t first_above(const uint8_t * a, const uint8_t * const * b, const size_t count, const size_t len, const uint64_t limit, uint64_t * results)
+			{
+				return Kernels::sse_u8_one_to_many(a, b, count, len, limit, results);
+			}
+		};
+
+		/** Mean squared error.  Movement is detected when the score is above the threshold.  The default threshold is
+		 * about the same as a PSNR of @p 32.0.
+		 */
+		struct SSE
+		{
+			static constexpr double default_threshold = 41.0;
+
+			static uint64_t distance(const uint8_t * a, const uint8_t * b, const size_t len)
+			{
+				return Kernels::sse_u8(a, b, len);
+			}
+
+			static uint64_t limit(const double threshold, const size_t values)
+			{
+				return static_cast<uint64_t>(std::floor(std::max(0.0, threshold) * static_cast<double>(values)));
+			}
+
+			static double score(const uint64_t distance, const size_t values)
+			{
+				return static_cast<double>(distance) / static_cast<double>(std::max<size_t>(1, values));
+			}
+
+			static size_t first_above(const uint8_t * a, const uint8_t * const * b, const size_t count, const size_t len, const uint64_t limit, uint64_t * results)
+			{
+				return Kernels::sse_u8_one_to_many(a, b, count, len, limit, results);
+			}
+		};
+
+		/** Mean absolute difference.  Movement is detected when the score is above the threshold.  This is less
+		 * sensitive than the squared metrics to a few pixels which change a lot, such as sensor noise.
+		 */
+		struct MAD
+		{
+			static constexpr double default_threshold = 4.0;
+
+			static uint64_t distance(const uint8_t * a, const uint8_t * b, const size_t len)
+			{
+				return Kernels::sad_u8(a, b, len);
+			}
+
+			static uint64_t limit(const double threshold, const size_t values)
+			{
+				return static_cast<uint64_t>(std::floor(std::max(0.0, threshold) * static_cast<double>(values)));
+			}
+
+			static double score(const uint64_t distance, const size_t values)
+			{
+				return static_cast<double>(distance) / static_cast<double>(std::max<size_t>(1, values));
+			}
+
+			static size_t first_above(const uint8_t * a, const uint8_t * const * b, const size_t count, const size_t len, const uint64_t limit, uint64_t * results)
+			{
+				for (size_t idx = 0; idx < count; idx ++)
+				{
+					results[idx] = distance(a, b[idx], len);
+					if (results[idx] > limit)
+					{
+						return idx;
+					}
+				}
+
+				return count;
+			}
+		};
+	}
+
+	/** A smaller version of @ref Handler where the image format, the metric, and the optional stages are all chosen at
+	 * compile time.  This is meant for deployments which always use the same settings, such as greyscale (luma) frames
+	 * without a mask, where the per-frame checks and the temporary images used by @ref Handler are pure overhead.
+	 *
+	 * @li The images are always 8-bit with @p Channels channels, so the type is only checked once per call.
+	 * @li The thumbnail is created with @ref Kernels::box_downscale_u8() directly into the control ring buffer.
+	 * @li The thumbnail is compared against all the control frames with a single call to @p Metric::first_above().
+	 * @li The mask, contours, and bounding box are only compiled in when requested in @p Stages.  @see @ref Features
+	 *
+	 * Nothing is allocated for each frame once the control ring buffer has been created, and the per-thread buffer used
+	 * by @ref Kernels::box_downscale_u8() has grown to the width of the frames on the first call.  The only exception is
+	 * when movement is detected and a mask was requested.
+	 *
+	 * ~~~~{.cpp}
+	 * MoveDetect::BasicHandler<1> luma;
+	 * MoveDetect::BasicHandler<3, MoveDetect::Metrics::MAD, MoveDetect::Features::BoundingBox> colour;
+	 *
+	 * if (luma.detect(frame_index, y_plane, width, height, stride))
+	 * {
+	 *     // ...
+	 * }
+	 * ~~~~
+	 *
+	 * @note Regions of interest, the grid, the cascade, adaptive frame skipping, colour balancing, and snapshots are only
+	 * available with @ref Handler.
+	 *
+	 * The results are not always the same as @ref Handler with the same settings:
+	 * @li With @ref Metrics::PSNR, thumbnails which are identical to a control have a score of infinity and are not
+	 * movement.  @ref Handler uses the convention of @ref MoveDetect::psnr(), where identical images score @p 0.0, which
+	 * is below any threshold and is reported as movement.
+	 * @li The mask is always closed with a 3x3 square kernel, and @ref morphology_iterations is the number of iterations
+	 * at the size of the thumbnail.  @ref Handler uses @ref Handler::morphology_shape and @ref Handler::morphology_size,
+	 * and @ref Handler::morphology_iterations is at the size of the image, which is scaled down when
+	 * @ref Handler::mask_low_resolution is set.
+	 */
+	template <int Channels, typename Metric = Metrics::PSNR, unsigned int Stages = Features::None>
+	class BasicHandler
+	{
+		static_assert(Channels == 1 or Channels == 3, "only 1-channel and 3-channel images are supported");
+
+		public:
+
+			/// The OpenCV type of the images and thumbnails.
+			static constexpr int image_type = CV_MAKETYPE(CV_8U, Channels);
+
+			static constexpr bool contours_enabled	= (Stages & Features::Contours) != 0;
+			static constexpr bool bbox_enabled		= (Stages & Features::BoundingBox) != 0;
+			static constexpr bool mask_enabled		= (Stages & Features::Mask) != 0 or contours_enabled or bbox_enabled;
+
+			/// Constructor.
+			BasicHandler()
+			{
+				clear();
+
+				return;
+			}
+
+			/// Destructor.
+			virtual ~BasicHandler()
+			{
+				return;
+			}
+
+			/// Remove all the control frames and reset all the settings to their default values.
+			BasicHandler & clear()
+			{
+				control.clear();
+				movement_detected			= false;
+				transition_detected			= false;
+				next_frame_index			= 0;
+				next_key_frame				= 0;
+				frame_index_with_movement	= 0;
+				key_frame_frequency			= 10;
+				number_of_control_frames	= 4;
+				threshold					= Metric::default_threshold;
+				most_recent_score			= 0.0;
+				thumbnail_ratio				= 0.05;
+				thumbnail_size				= cv::Size(0, 0);
+				morphology_iterations		= 1;
+				mask						= cv::Mat();
+				contours.clear();
+				bbox						= cv::Rect();
+				mask_is_blank				= false;
+
+				return *this;
+			}
+
+			/// Same as @ref Handler::detect(), using @ref next_frame_index.
+			bool detect(const cv::Mat & image)
+			{
+				return detect(next_frame_index, image);
+			}
+
+			/// Same as @ref Handler::detect().  The image must be 8-bit with @p Channels channels.
+			bool detect(const size_t frame_index, const cv::Mat & image)
+			{
+				if (image.type() != image_type)
+				{
+					throw std::invalid_argument("image does not match the type of this handler");
+				}
+
+				return detect(frame_index, image.ptr<uint8_t>(), image.cols, image.rows, image.step[0]);
+			}
+
+			/** Detect movement in a raw buffer of interleaved 8-bit pixels, without creating a @p cv::Mat.  For example,
+			 * the Y plane of a YUV frame can be passed as-is to a 1-channel handler.  The buffer is only used during this
+			 * call.
+			 */
+			bool detect(const size_t frame_index, const uint8_t * data, const int width, const int height, const size_t stride)
+			{
+				if (data == nullptr or width <= 0 or height <= 0 or stride < static_cast<size_t>(width) * Channels)
+				{
+					throw std::invalid_argument("invalid image buffer");
+				}
+
+				if (thumbnail_size.area() <= 1)
+				{
+					const double ratio		= std::clamp(thumbnail_ratio, 0.01, 1.0);
+					thumbnail_size.width	= std::max(1, static_cast<int>(width * ratio));
+					thumbnail_size.height	= std::max(1, static_cast<int>(height * ratio));
+				}
+
+				if (thumbnail_size.width > width or thumbnail_size.height > height)
+				{
+					throw std::invalid_argument("thumbnail cannot be larger than the image");
+				}
+
+				control.reserve(number_of_control_frames, thumbnail_size, image_type);
+
+				// the thumbnail is created directly in the next slot of the ring buffer, which is always continuous
+				cv::Mat & thumbnail = control.next();
+				Kernels::box_downscale_u8(data, stride, width, height, Channels, thumbnail.ptr<uint8_t>(), thumbnail.step[0], thumbnail.cols, thumbnail.rows, 0, thumbnail.rows);
+
+				const size_t number_of_values	= thumbnail.total() * Channels;
+				const size_t number_of_controls	= control.size();
+				cv::AutoBuffer<const uint8_t *> pointers(number_of_controls);
+				cv::AutoBuffer<const cv::Mat *> controls(number_of_controls);
+				cv::AutoBuffer<uint64_t> results(number_of_controls);
+
+				// most recent control first, since that is where movement is most likely to be seen
+				size_t idx = 0;
+				for (auto iter = control.rbegin(); iter != control.rend(); iter ++, idx ++)
+				{
+					pointers[idx] = iter->second.ptr<uint8_t>();
+					if constexpr (mask_enabled)
+					{
+						controls[idx] = &iter->second;
+					}
+				}
+
+				const uint64_t limit = Metric::limit(threshold, number_of_values);
+				idx = Metric::first_above(thumbnail.ptr<uint8_t>(), pointers.data(), number_of_controls, number_of_values, limit, results.data());
+
+				const bool previous_movement_detected = movement_detected;
+				movement_detected = (idx < number_of_controls);
+				transition_detected = (previous_movement_detected != movement_detected);
+
+				if (movement_detected)
+				{
+					most_recent_score			= Metric::score(results[idx], number_of_values);
+					frame_index_with_movement	= frame_index;
+				}
+				else if (number_of_controls > 0)
+				{
+					// the control which is the most different is the one closest to the threshold
+					most_recent_score = Metric::score(*std::max_element(results.data(), results.data() + number_of_controls), number_of_values);
+				}
+
+				if constexpr (mask_enabled)
+				{
+					update_mask(movement_detected ? controls[idx] : nullptr, thumbnail, cv::Size(width, height));
+				}
+
+				if (frame_index >= next_key_frame or control.size() < number_of_control_frames)
+				{
+					control.push(frame_index);
+					next_key_frame = frame_index + key_frame_frequency;
+				}
+
+				next_frame_index = frame_index + 1;
+
+				return movement_detected;
+			}
+
+			/// @see @ref Handler::movement_detected
+			bool movement_detected;
+
+			/// @see @ref Handler::transition_detected
+			bool transition_detected;
+
+			/// @see @ref Handler::next_frame_index
+			size_t next_frame_index;
+
+			/// @see @ref Handler::next_key_frame
+			size_t next_key_frame;
+
+			/// @see @ref Handler::frame_index_with_movement
+			size_t frame_index_with_movement;
+
+			/// @see @ref Handler::key_frame_frequency
+			size_t key_frame_frequency;
+
+			/// @see @ref Handler::number_of_control_frames
+			size_t number_of_control_frames;
+
+			/** The threshold used by @p Metric.  For @ref Metrics::PSNR movement is detected below the threshold, for the
+			 * other metrics movement is detected above the threshold.  Default value is @p Metric::default_threshold.
+			 */
+			double threshold;
+
+			/** The score from the most recent frame.  When there is movement, this is the score against the control where
+			 * movement was detected, otherwise it is the score against the control which is the most different.
+			 */
+			double most_recent_score;
+
+			/// @see @ref Handler::thumbnail_ratio
+			double thumbnail_ratio;
+
+			/// @see @ref Handler::thumbnail_size
+			cv::Size thumbnail_size;
+
+			/** The number of times the thumbnail-sized mask is dilated and then eroded with a 3x3 square kernel.  Unlike
+			 * @ref Handler::morphology_iterations, this is not scaled by the size of the thumbnail.  Use @p 0 to disable.
+			 * Default value is @p 1.
+			 */
+			int morphology_iterations;
+
+			/// The control thumbnails.  @see @ref Handler::control
+			ControlMap control;
+
+			/** Binary mask the size of the image, created at thumbnail resolution.  This is only set when @p Stages
+			 * includes @ref Features::Mask, @ref Features::Contours, or @ref Features::BoundingBox.
+			 */
+			cv::Mat mask;
+
+			/// Only set when @p Stages includes @ref Features::Contours.
+			Handler::Contours contours;
+
+			/// Only set when @p Stages includes @ref Features::BoundingBox.
+			cv::Rect bbox;
+
+		private:
+
+			/// Create the mask, contours, and bounding box.  When @p movement_control is @p nullptr, the mask is blank.
+			void update_mask(const cv::Mat * movement_control, const cv::Mat & thumbnail, const cv::Size & image_size)
+			{
+				if (movement_control == nullptr)
+				{
+					if (mask.size() != image_size or mask_is_blank == false)
+					{
+						mask = cv::Mat::zeros(image_size, CV_8UC1);
+						mask_is_blank = true;
+					}
+					contours.clear();
+					bbox = cv::Rect();
+
+					return;
+				}
+
+				cv::absdiff(*movement_control, thumbnail, differences);
+				if constexpr (Channels == 3)
+				{
+					cv::cvtColor(differences, greyscale, cv::COLOR_BGR2GRAY);
+				}
+				else
+				{
+					greyscale = differences;
+				}
+
+				cv::threshold(greyscale, binary, 0.0, 255.0, cv::THRESH_BINARY | cv::THRESH_OTSU);
+				if (morphology_iterations > 0)
+				{
+					// same as cv::dilate() and cv::erode() with a 3x3 kernel, the same fast path as Handler::close_mask()
+					const size_t radius = static_cast<size_t>(morphology_iterations);
+					dilated.create(binary.size(), CV_8UC1);
+					Kernels::dilate_rect_u8(binary.ptr<uint8_t>(), binary.step[0], dilated.ptr<uint8_t>(), dilated.step[0], binary.cols, binary.rows, radius);
+					Kernels::erode_rect_u8(dilated.ptr<uint8_t>(), dilated.step[0], binary.ptr<uint8_t>(), binary.step[0], binary.cols, binary.rows, radius);
+				}
+				cv::resize(binary, mask, image_size, 0, 0, cv::INTER_NEAREST);
+				mask_is_blank = false;
+
+				if constexpr (contours_enabled)
+				{
+					std::vector<cv::Vec4i> hierarchy;
+					cv::findContours(mask, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+				}
+
+				if constexpr (bbox_enabled)
+				{
+					bbox = cv::boundingRect(mask);
+				}
+
+				return;
+			}
+
+			/// Thumbnail-sized images re-used for every frame with movement.
+			cv::Mat differences;
+			cv::Mat greyscale;
+			cv::Mat binary;
+			cv::Mat dilated;
+
+			/// Remember when the mask is blank so it does not need to be cleared again for every frame without movement.
+			bool mask_is_blank;
+	};
+}
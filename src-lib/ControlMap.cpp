@@ -0,0 +1,228 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "ControlMap.hpp"
+#include <algorithm>
+
+
+namespace
+{
+	/// Each slot starts on a new cache line.
+	const size_t cache_line_size = 64;
+}
+
+
+MoveDetect::ControlMap::ControlMap()
+{
+	clear();
+
+	return;
+}
+
+
+MoveDetect::ControlMap::ControlMap(const ControlMap & rhs)
+{
+	clear();
+	*this = rhs;
+
+	return;
+}
+
+
+MoveDetect::ControlMap & MoveDetect::ControlMap::operator=(const ControlMap & rhs)
+{
+	if (this != &rhs)
+	{
+		clear();
+		if (rhs.maximum > 0)
+		{
+			allocate(rhs.maximum, rhs.size_of_thumbnail, rhs.type_of_thumbnail);
+			for (const auto & [frame_index, thumbnail] : rhs)
+			{
+				insert(frame_index, thumbnail);
+			}
+		}
+	}
+
+	return *this;
+}
+
+
+MoveDetect::ControlMap::~ControlMap()
+{
+	return;
+}
+
+
+MoveDetect::ControlMap & MoveDetect::ControlMap::clear()
+{
+	slab				= cv::Mat();
+	slots.clear();
+	head				= 0;
+	entries				= 0;
+	maximum				= 0;
+	size_of_thumbnail	= cv::Size(0, 0);
+	type_of_thumbnail	= -1;
+
+	return *this;
+}
+
+
+MoveDetect::ControlMap & MoveDetect::ControlMap::reserve(const size_t number_of_controls, const cv::Size & size, const int type)
+{
+	if (slots.empty() or size != size_of_thumbnail or type != type_of_thumbnail)
+	{
+		clear();
+		allocate(number_of_controls, size, type);
+	}
+	else if (number_of_controls != maximum)
+	{
+		// keep as many of the most recent thumbnails as we can
+		ControlMap old(*this);
+		clear();
+		allocate(number_of_controls, size, type);
+
+		auto iter = old.begin();
+		std::advance(iter, old.size() - std::min(old.size(), number_of_controls));
+		while (iter != old.end())
+		{
+			insert(iter->first, iter->second);
+			iter ++;
+		}
+	}
+
+	return *this;
+}
+
+
+cv::Mat & MoveDetect::ControlMap::next()
+{
+	if (slots.empty())
+	{
+		throw std::logic_error("control map must be reserved before it can be used");
+	}
+
+	const size_t idx = (head + entries) % slots.size();
+	if (slab.empty())
+	{
+		// One row per slot, so every thumbnail starts on a new cache line.  The thumbnails are created from the rows of
+		// the slab so they share the same reference count.
+		const size_t bytes	= static_cast<size_t>(size_of_thumbnail.area()) * CV_ELEM_SIZE(type_of_thumbnail);
+		const size_t stride	= std::max<size_t>(1, (bytes + cache_line_size - 1) / cache_line_size) * cache_line_size;
+		slab = cv::Mat(slots.size(), stride / CV_ELEM_SIZE1(type_of_thumbnail), CV_MAKETYPE(CV_MAT_DEPTH(type_of_thumbnail), 1));
+	}
+
+	cv::Mat & thumbnail = slots[idx].second;
+	if (thumbnail.datastart != slab.datastart)
+	{
+		// This slot has never been used, or was last used by a shared thumbnail which must never be overwritten.
+		thumbnail = slab_thumbnail(idx);
+	}
+
+	return thumbnail;
+}
+
+
+MoveDetect::ControlMap & MoveDetect::ControlMap::push(const size_t frame_index)
+{
+	slots[(head + entries) % slots.size()].first = frame_index;
+	entries ++;
+
+	while (entries > maximum)
+	{
+		// the oldest thumbnail is dropped, and its slot becomes available for the next thumbnail
+		head = (head + 1) % slots.size();
+		entries --;
+	}
+
+	return *this;
+}
+
+
+MoveDetect::ControlMap & MoveDetect::ControlMap::insert(const size_t frame_index, const cv::Mat & thumbnail)
+{
+	if (thumbnail.size() != size_of_thumbnail or thumbnail.type() != type_of_thumbnail)
+	{
+		throw std::invalid_argument("thumbnail does not match the control map");
+	}
+
+	thumbnail.copyTo(next());
+
+	return push(frame_index);
+}
+
+
+MoveDetect::ControlMap & MoveDetect::ControlMap::share(const size_t frame_index, const cv::Mat & thumbnail)
+{
+	if (slots.empty())
+	{
+		throw std::logic_error("control map must be reserved before it can be used");
+	}
+
+	if (thumbnail.size() != size_of_thumbnail or thumbnail.type() != type_of_thumbnail)
+	{
+		throw std::invalid_argument("thumbnail does not match the control map");
+	}
+
+	// only the header is copied, the previous thumbnail in this slot is released
+	slots[(head + entries) % slots.size()].second = thumbnail;
+
+	return push(frame_index);
+}
+
+
+MoveDetect::ControlMap::const_iterator MoveDetect::ControlMap::find(const size_t frame_index) const
+{
+	for (auto iter = begin(); iter != end(); iter ++)
+	{
+		if (iter->first == frame_index)
+		{
+			return iter;
+		}
+	}
+
+	return end();
+}
+
+
+const cv::Mat & MoveDetect::ControlMap::at(const size_t frame_index) const
+{
+	const auto iter = find(frame_index);
+	if (iter == end())
+	{
+		throw std::out_of_range("frame index " + std::to_string(frame_index) + " is not a control");
+	}
+
+	return iter->second;
+}
+
+
+const MoveDetect::ControlMap::value_type & MoveDetect::ControlMap::entry(const size_t position) const
+{
+	return slots[(head + position) % slots.size()];
+}
+
+
+void MoveDetect::ControlMap::allocate(const size_t number_of_controls, const cv::Size & size, const int type)
+{
+	// the memory is only allocated once it is needed by next()
+	slab = cv::Mat();
+	slots.assign(number_of_controls + 1, value_type(0, cv::Mat()));
+
+	head				= 0;
+	entries				= 0;
+	maximum				= number_of_controls;
+	size_of_thumbnail	= size;
+	type_of_thumbnail	= type;
+
+	return;
+}
+
+
+cv::Mat MoveDetect::ControlMap::slab_thumbnail(const size_t idx) const
+{
+	const size_t elements = static_cast<size_t>(size_of_thumbnail.area()) * CV_MAT_CN(type_of_thumbnail);
+
+	return slab.row(idx).colRange(0, elements).reshape(CV_MAT_CN(type_of_thumbnail), size_of_thumbnail.height);
+}
@@ -0,0 +1,171 @@
+// MoveDetect -- Library to detect whether movement can be detected between two images or video frames.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <iterator>
+#include <utility>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+namespace MoveDetect
+{
+	/** We keep several control thumbnail images to compare against.  This class tracks these thumbnails, and can be
+	 * iterated like the @p std::map it replaces:  @p first is the frame index, @p second is the thumbnail itself, and
+	 * iteration goes from the oldest thumbnail to the most recent one.
+	 *
+	 * Internally, this is a fixed-capacity ring buffer.  All of the thumbnails live in a single cache-aligned block of
+	 * memory which is allocated once, so new thumbnails can be written directly into the next available slot without
+	 * any further heap allocations.
+	 *
+	 * @note Each @p cv::Mat is a view into the ring buffer.  Once the ring buffer wraps around, the same memory will be
+	 * reused for newer thumbnails, so callers must clone the thumbnail if they need to keep it.
+	 *
+	 * Thumbnails can also be added with @ref share(), in which case the control is a reference to the caller's thumbnail
+	 * rather than a copy.  The block of memory is only allocated the first time @ref next() is called, so a control map
+	 * which only holds shared thumbnails never allocates any memory of its own.
+	 */
+	class ControlMap
+	{
+		public:
+
+			/// Each control is a frame index and the thumbnail for that frame.
+			typedef std::pair<size_t, cv::Mat> value_type;
+
+			/// Bidirectional iterator, from the oldest control thumbnail to the most recent.
+			class const_iterator
+			{
+				public:
+
+					typedef std::bidirectional_iterator_tag	iterator_category;
+					typedef ControlMap::value_type			value_type;
+					typedef std::ptrdiff_t					difference_type;
+					typedef const value_type *				pointer;
+					typedef const value_type &				reference;
+
+					const_iterator() : map(nullptr), position(0) {}
+					const_iterator(const ControlMap * m, const size_t p) : map(m), position(p) {}
+
+					reference operator*() const			{ return map->entry(position);	}
+					pointer operator->() const			{ return &map->entry(position);	}
+					const_iterator & operator++()		{ position ++; return *this;	}
+					const_iterator & operator--()		{ position --; return *this;	}
+					const_iterator operator++(int)		{ const_iterator tmp = *this; position ++; return tmp; }
+					const_iterator operator--(int)		{ const_iterator tmp = *this; position --; return tmp; }
+					bool operator==(const const_iterator & rhs) const { return map == rhs.map and position == rhs.position; }
+					bool operator!=(const const_iterator & rhs) const { return not (*this == rhs); }
+
+				private:
+
+					const ControlMap * map;
+					size_t position;
+			};
+
+			typedef const_iterator							iterator;
+			typedef std::reverse_iterator<const_iterator>	const_reverse_iterator;
+			typedef const_reverse_iterator					reverse_iterator;
+
+			/// Constructor.
+			ControlMap();
+
+			/// Copy constructor.  The thumbnails are copied into a new ring buffer.
+			ControlMap(const ControlMap & rhs);
+
+			/// Assignment operator.  The thumbnails are copied into a new ring buffer.
+			ControlMap & operator=(const ControlMap & rhs);
+
+			/// Destructor.
+			virtual ~ControlMap();
+
+			/// Remove all the thumbnails and release the ring buffer.
+			ControlMap & clear();
+
+			/** Prepare the ring buffer to hold the given number of thumbnails.  If the thumbnail size or type changes, all
+			 * existing thumbnails are removed.  If only the number of thumbnails changes, the most recent thumbnails are kept.
+			 * Nothing is done if the ring buffer is already set up this way.
+			 */
+			ControlMap & reserve(const size_t number_of_controls, const cv::Size & size, const int type);
+
+			/** Get the next unused slot in the ring buffer.  The new thumbnail should be written directly into this image,
+			 * for example as the destination of @p cv::resize().  Call @ref push() to turn it into a control thumbnail.
+			 * If @ref push() is not called, the slot will be handed out again the next time.
+			 */
+			cv::Mat & next();
+
+			/** Keep the thumbnail previously written into @ref next() as the most recent control, removing the oldest
+			 * thumbnail if the ring buffer is full.
+			 */
+			ControlMap & push(const size_t frame_index);
+
+			/// Copy an existing thumbnail into the ring buffer.  This is the same as copying into @ref next() and calling @ref push().
+			ControlMap & insert(const size_t frame_index, const cv::Mat & thumbnail);
+
+			/** Keep a reference to an existing thumbnail instead of copying it into the ring buffer.  The pixels are shared
+			 * using the usual @p cv::Mat reference counting, and are released once the thumbnail falls out of the ring
+			 * buffer and the slot is used again.
+			 *
+			 * @warning The caller must not modify the pixels once the thumbnail has been shared.
+			 */
+			ControlMap & share(const size_t frame_index, const cv::Mat & thumbnail);
+
+			/// Number of control thumbnails currently stored.
+			size_t size() const { return entries; }
+
+			/// Determine if there are no control thumbnails.
+			bool empty() const { return entries == 0; }
+
+			/// Maximum number of control thumbnails.  @see @ref reserve()
+			size_t capacity() const { return maximum; }
+
+			/// Size of the thumbnails stored in the ring buffer.
+			cv::Size thumbnail_size() const { return size_of_thumbnail; }
+
+			/// OpenCV type of the thumbnails stored in the ring buffer.
+			int thumbnail_type() const { return type_of_thumbnail; }
+
+			const_iterator begin() const					{ return const_iterator(this, 0);		}
+			const_iterator end() const						{ return const_iterator(this, entries);	}
+			const_reverse_iterator rbegin() const			{ return const_reverse_iterator(end());	}
+			const_reverse_iterator rend() const				{ return const_reverse_iterator(begin()); }
+
+			/// Find the thumbnail for the given frame index, or return @ref end() if that frame index is not a control.
+			const_iterator find(const size_t frame_index) const;
+
+			/// Returns @p 1 if the frame index is a control, otherwise returns @p 0.
+			size_t count(const size_t frame_index) const { return find(frame_index) == end() ? 0 : 1; }
+
+			/// Get the thumbnail for the given frame index.  @throw std::out_of_range if the frame index is not a control.
+			const cv::Mat & at(const size_t frame_index) const;
+
+		private:
+
+			/// Get the entry at the given position, where @p 0 is the oldest control.
+			const value_type & entry(const size_t position) const;
+
+			/// Create the empty slots.  The memory block is allocated later by @ref next().
+			void allocate(const size_t number_of_controls, const cv::Size & size, const int type);
+
+			/// Get a thumbnail header which points to the given row of @ref slab.
+			cv::Mat slab_thumbnail(const size_t idx) const;
+
+			/// Single block of memory that holds all the thumbnails.  Each row is one slot.
+			cv::Mat slab;
+
+			/// One entry per slot.  The thumbnails are headers which point into @ref slab, or to shared thumbnails.
+			std::vector<value_type> slots;
+
+			/// Slot which contains the oldest control.
+			size_t head;
+
+			/// Number of controls currently stored.
+			size_t entries;
+
+			/// Maximum number of controls.  There is always one additional slot available for the next thumbnail.
+			size_t maximum;
+
+			cv::Size size_of_thumbnail;
+			int type_of_thumbnail;
+	};
+}
@@ -0,0 +1,353 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "DetectorPool.hpp"
+
+
+MoveDetect::DetectorPool::DetectorPool(const size_t number_of_threads) :
+	ready_streams(0),
+	outstanding_jobs(0),
+	next_worker(0),
+	stopping(false)
+{
+	size_t count = number_of_threads;
+	if (count == 0)
+	{
+		count = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (size_t idx = 0; idx < count; idx ++)
+	{
+		workers.emplace_back(new Worker);
+	}
+
+	for (size_t idx = 0; idx < count; idx ++)
+	{
+		threads.emplace_back(&DetectorPool::run, this, idx);
+	}
+
+	return;
+}
+
+
+MoveDetect::DetectorPool::~DetectorPool()
+{
+	try
+	{
+		wait();
+	}
+	catch (...)
+	{
+		// nothing we can do about callback exceptions at this point
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock);
+		stopping = true;
+	}
+	wakeup.notify_all();
+
+	for (auto & thread : threads)
+	{
+		thread.join();
+	}
+
+	return;
+}
+
+
+size_t MoveDetect::DetectorPool::add_stream()
+{
+	return add_stream(Handler());
+}
+
+
+size_t MoveDetect::DetectorPool::add_stream(const Handler & configuration)
+{
+	std::lock_guard<std::mutex> guard(streams_lock);
+
+	std::unique_ptr<Stream> stream(new Stream);
+	stream->stream_id	= streams.size();
+	stream->handler		= configuration;
+	stream->scheduled	= false;
+	streams.push_back(std::move(stream));
+
+	return streams.size() - 1;
+}
+
+
+MoveDetect::Handler & MoveDetect::DetectorPool::handler(const size_t stream_id)
+{
+	return get_stream(stream_id).handler;
+}
+
+
+size_t MoveDetect::DetectorPool::number_of_streams() const
+{
+	std::lock_guard<std::mutex> guard(streams_lock);
+
+	return streams.size();
+}
+
+
+size_t MoveDetect::DetectorPool::number_of_threads() const
+{
+	return threads.size();
+}
+
+
+std::future<MoveDetect::Result> MoveDetect::DetectorPool::submit(const size_t stream_id, const cv::Mat & frame)
+{
+	Job job;
+	job.frame = frame;
+	std::future<Result> future = job.promise.get_future();
+
+	enqueue(stream_id, std::move(job));
+
+	return future;
+}
+
+
+void MoveDetect::DetectorPool::submit(const size_t stream_id, const cv::Mat & frame, Callback callback)
+{
+	if (not callback)
+	{
+		throw std::invalid_argument("callback cannot be empty");
+	}
+
+	Job job;
+	job.frame		= frame;
+	job.callback	= callback;
+
+	enqueue(stream_id, std::move(job));
+
+	return;
+}
+
+
+void MoveDetect::DetectorPool::wait()
+{
+	std::unique_lock<std::mutex> guard(sleep_lock);
+	idle.wait(guard, [&]{ return outstanding_jobs == 0; });
+
+	if (callback_exception)
+	{
+		std::exception_ptr ptr = callback_exception;
+		callback_exception = nullptr;
+		std::rethrow_exception(ptr);
+	}
+
+	return;
+}
+
+
+void MoveDetect::DetectorPool::enqueue(const size_t stream_id, Job && job)
+{
+	if (job.frame.empty())
+	{
+		throw std::invalid_argument("cannot submit an empty frame");
+	}
+
+	Stream & stream = get_stream(stream_id);
+
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock);
+		outstanding_jobs ++;
+	}
+
+	bool needs_scheduling = false;
+	{
+		std::lock_guard<std::mutex> guard(stream.lock);
+		stream.pending.push_back(std::move(job));
+		if (stream.scheduled == false)
+		{
+			stream.scheduled = true;
+			needs_scheduling = true;
+		}
+	}
+
+	if (needs_scheduling)
+	{
+		schedule(next_worker ++ % workers.size(), stream);
+	}
+
+	return;
+}
+
+
+void MoveDetect::DetectorPool::schedule(const size_t worker_index, Stream & stream)
+{
+	Worker & worker = *workers[worker_index];
+
+	{
+		std::lock_guard<std::mutex> guard(worker.lock);
+		worker.ready.push_back(&stream);
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock);
+		ready_streams ++;
+	}
+	wakeup.notify_one();
+
+	return;
+}
+
+
+MoveDetect::DetectorPool::Stream & MoveDetect::DetectorPool::get_stream(const size_t stream_id) const
+{
+	std::lock_guard<std::mutex> guard(streams_lock);
+
+	if (stream_id >= streams.size())
+	{
+		throw std::out_of_range("invalid stream id " + std::to_string(stream_id));
+	}
+
+	return *streams[stream_id];
+}
+
+
+MoveDetect::DetectorPool::Stream * MoveDetect::DetectorPool::next_stream(const size_t worker_index)
+{
+	// start with our own queue -- the most recently added stream is the one most likely to still be in the cache
+	for (size_t offset = 0; offset < workers.size(); offset ++)
+	{
+		Worker & worker = *workers[(worker_index + offset) % workers.size()];
+		std::lock_guard<std::mutex> guard(worker.lock);
+
+		if (worker.ready.empty() == false)
+		{
+			Stream * stream = nullptr;
+			if (offset == 0)
+			{
+				stream = worker.ready.back();
+				worker.ready.pop_back();
+			}
+			else
+			{
+				// steal the oldest stream from another worker
+				stream = worker.ready.front();
+				worker.ready.pop_front();
+			}
+			ready_streams --;
+
+			return stream;
+		}
+	}
+
+	return nullptr;
+}
+
+
+void MoveDetect::DetectorPool::run(const size_t worker_index)
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> guard(sleep_lock);
+			wakeup.wait(guard, [&]{ return stopping or ready_streams > 0; });
+			if (stopping and ready_streams == 0)
+			{
+				break;
+			}
+		}
+
+		Stream * stream = next_stream(worker_index);
+		if (stream)
+		{
+			process(worker_index, *stream);
+		}
+	}
+
+	return;
+}
+
+
+void MoveDetect::DetectorPool::process(const size_t worker_index, Stream & stream)
+{
+	Job job;
+	{
+		std::lock_guard<std::mutex> guard(stream.lock);
+		job = std::move(stream.pending.front());
+		stream.pending.pop_front();
+	}
+
+	Result result;
+	std::exception_ptr exception;
+	try
+	{
+		Handler & handler = stream.handler;
+		handler.detect(job.frame);
+
+		result.stream_id			= stream.stream_id;
+		result.frame_index			= handler.next_frame_index - 1;
+		result.movement_detected	= handler.movement_detected;
+		result.transition_detected	= handler.transition_detected;
+		result.psnr_score			= handler.most_recent_psnr_score;
+		result.mask					= handler.mask;
+		result.output				= handler.output;
+	}
+	catch (...)
+	{
+		exception = std::current_exception();
+	}
+
+	// The result is delivered while we still own the stream, so the callbacks for one stream are never called at the
+	// same time or out of order.  A callback may submit more frames, which are only queued since the stream is still
+	// marked as scheduled.
+	if (job.callback)
+	{
+		if (exception == nullptr)
+		{
+			try
+			{
+				job.callback(result);
+			}
+			catch (...)
+			{
+				exception = std::current_exception();
+			}
+		}
+
+		if (exception)
+		{
+			std::lock_guard<std::mutex> guard(sleep_lock);
+			if (callback_exception == nullptr)
+			{
+				callback_exception = exception;
+			}
+		}
+	}
+	else if (exception)
+	{
+		job.promise.set_exception(exception);
+	}
+	else
+	{
+		job.promise.set_value(result);
+	}
+
+	// If there is more work, the stream goes back into our own queue where another idle worker can steal it.
+	bool more_work = false;
+	{
+		std::lock_guard<std::mutex> guard(stream.lock);
+		more_work = (stream.pending.empty() == false);
+		if (more_work == false)
+		{
+			stream.scheduled = false;
+		}
+	}
+	if (more_work)
+	{
+		schedule(worker_index, stream);
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock);
+		outstanding_jobs --;
+	}
+	idle.notify_all();
+
+	return;
+}
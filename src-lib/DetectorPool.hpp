@@ -0,0 +1,176 @@
+// MoveDetect -- Library to detect whether movement can be detected between two images or video frames.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "MoveDetect.hpp"
+
+
+namespace MoveDetect
+{
+	/** Run many @ref Handler objects -- one per video stream -- on a fixed number of worker threads.
+	 *
+	 * Frames are submitted with the ID of the stream to which they belong.  Frames from the same stream are always
+	 * processed in the order in which they were submitted, and never by more than one thread at a time, since
+	 * @ref Handler::detect() is not thread-safe.  The results for each stream are also delivered in that same order, and
+	 * the callback for a frame returns before the next frame from the same stream is processed.  Frames from different
+	 * streams are processed in parallel.
+	 *
+	 * Each worker thread has its own queue of streams which have frames waiting to be processed.  When a worker runs out
+	 * of streams, it steals from the queue of another worker.  This keeps all the threads busy even when some streams
+	 * have much more work than others, without creating more threads than there are cores.
+	 *
+	 * ~~~~{.cpp}
+	 * MoveDetect::DetectorPool pool;
+	 * const size_t stream_id = pool.add_stream();
+	 * pool.handler(stream_id).psnr_threshold = 30.0;
+	 *
+	 * auto future = pool.submit(stream_id, frame);
+	 * const MoveDetect::Result result = future.get();
+	 * ~~~~
+	 *
+	 * @note OpenCV may also use multiple threads internally.  When many streams are processed at once, consider calling
+	 * @p cv::setNumThreads(1) so the worker threads in this pool are the only ones competing for the cores.
+	 */
+	class DetectorPool
+	{
+		public:
+
+			/// Callback used to deliver the results.  It is called on one of the worker threads.
+			typedef std::function<void(const Result & result)> Callback;
+
+			/** Constructor.  When @p number_of_threads is zero, one worker thread is started for each hardware thread.
+			 * The threads are started immediately and remain running until the pool is destroyed.
+			 */
+			DetectorPool(const size_t number_of_threads = 0);
+
+			/// Destructor.  This will wait for all the frames which have been submitted to be processed.
+			virtual ~DetectorPool();
+
+			/** Add a new stream with a default @ref Handler.  The handler can be configured using @ref handler() before
+			 * frames are submitted.
+			 *
+			 * @return The ID of the new stream, which is needed to submit frames.
+			 */
+			size_t add_stream();
+
+			/** Add a new stream, using @p configuration as the initial handler.
+			 *
+			 * @return The ID of the new stream, which is needed to submit frames.
+			 */
+			size_t add_stream(const Handler & configuration);
+
+			/** Access the handler for the given stream.
+			 *
+			 * @warning Do not modify the handler while frames for this stream are being processed.  Call @ref wait() first.
+			 */
+			Handler & handler(const size_t stream_id);
+
+			/// Get the number of streams that have been added.
+			size_t number_of_streams() const;
+
+			/// Get the number of worker threads.
+			size_t number_of_threads() const;
+
+			/** Queue a frame to be processed by the handler of the given stream.  The result is returned through a future.
+			 * Any exception thrown by @ref Handler::detect() is also returned through the future.
+			 *
+			 * @note The frame is not copied.  The caller must not modify the pixels until the result is available.
+			 */
+			std::future<Result> submit(const size_t stream_id, const cv::Mat & frame);
+
+			/** Queue a frame to be processed by the handler of the given stream.  The result is delivered to @p callback.
+			 * If @ref Handler::detect() throws an exception, the callback is not called and the first such exception is
+			 * rethrown from @ref wait().
+			 *
+			 * @note The frame is not copied.  The caller must not modify the pixels until the callback has been called.
+			 */
+			void submit(const size_t stream_id, const cv::Mat & frame, Callback callback);
+
+			/// Wait until all the frames submitted so far have been processed.
+			void wait();
+
+		private:
+
+			/// A single frame waiting to be processed.
+			struct Job
+			{
+				cv::Mat frame;
+				std::promise<Result> promise;
+				Callback callback;
+			};
+
+			/// Everything needed to process the frames for one stream.
+			struct Stream
+			{
+				size_t stream_id;
+				Handler handler;
+				std::mutex lock;
+				std::deque<Job> pending;
+
+				/// Set while the stream is sitting in a worker queue or being processed.  Only one thread may own a stream.
+				bool scheduled;
+			};
+
+			/// Each thread owns a queue of streams that have frames to process.
+			struct Worker
+			{
+				std::mutex lock;
+				std::deque<Stream *> ready;
+			};
+
+			/// The main loop for each worker thread.
+			void run(const size_t worker_index);
+
+			/// Find a stream to process, first from the given worker's own queue and then by stealing from the others.
+			Stream * next_stream(const size_t worker_index);
+
+			/// Process the next frame for the given stream, then either give the stream back to the worker or release it.
+			void process(const size_t worker_index, Stream & stream);
+
+			/// Put a stream into the queue of the given worker and wake up a thread to process it.
+			void schedule(const size_t worker_index, Stream & stream);
+
+			/// Add a job to the stream, and schedule the stream if it is not already scheduled.
+			void enqueue(const size_t stream_id, Job && job);
+
+			Stream & get_stream(const size_t stream_id) const;
+
+			/// Streams are never removed, and the pointers remain valid for the lifetime of the pool.
+			std::vector<std::unique_ptr<Stream>> streams;
+			mutable std::mutex streams_lock;
+
+			std::vector<std::unique_ptr<Worker>> workers;
+			std::vector<std::thread> threads;
+
+			/// Used to put idle threads to sleep, and to wait for the pool to become idle.
+			std::mutex sleep_lock;
+			std::condition_variable wakeup;
+			std::condition_variable idle;
+
+			/// Number of streams currently sitting in the worker queues.
+			std::atomic<size_t> ready_streams;
+
+			/// Number of frames which have been submitted but not yet processed.
+			size_t outstanding_jobs;
+
+			/// The first exception thrown when results are delivered through callbacks.
+			std::exception_ptr callback_exception;
+
+			/// Round-robin index used to spread new work across the workers.
+			std::atomic<size_t> next_worker;
+
+			bool stopping;
+	};
+}
@@ -0,0 +1,67 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "IntervalTracker.hpp"
+
+
+MoveDetect::IntervalTracker::IntervalTracker() :
+	interval_is_open(false)
+{
+	return;
+}
+
+
+MoveDetect::IntervalTracker::~IntervalTracker()
+{
+	return;
+}
+
+
+bool MoveDetect::IntervalTracker::add(const Handler & handler)
+{
+	// detect() has already moved on to the next frame index
+	const size_t frame_index	= (handler.next_frame_index > 0 ? handler.next_frame_index - 1 : 0);
+	const double psnr			= handler.most_recent_psnr_score;
+
+	if (handler.movement_detected == false)
+	{
+		const bool interval_ended = interval_is_open;
+		interval_is_open = false;
+
+		return interval_ended;
+	}
+
+	if (interval_is_open == false)
+	{
+		current				= MotionInterval();
+		current.start_frame	= frame_index;
+		current.min_psnr	= psnr;
+		current.max_psnr	= psnr;
+		current.peak_frame	= frame_index;
+		interval_is_open	= true;
+	}
+
+	// skipped frames keep the result of the previous frame, but do not have a PSNR of their own
+	current.end_frame = frame_index;
+	if (handler.frame_skipped == false and psnr < current.min_psnr)
+	{
+		current.min_psnr	= psnr;
+		current.peak_frame	= frame_index;
+	}
+	if (handler.frame_skipped == false and psnr > current.max_psnr)
+	{
+		current.max_psnr	= psnr;
+	}
+
+	return false;
+}
+
+
+bool MoveDetect::IntervalTracker::finish()
+{
+	const bool interval_ended = interval_is_open;
+	interval_is_open = false;
+
+	return interval_ended;
+}
@@ -0,0 +1,71 @@
+// MoveDetect -- Library to detect whether movement can be detected between two images or video frames.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include "MoveDetect.hpp"
+
+
+namespace MoveDetect
+{
+	/** Build @ref MotionInterval objects one frame at a time, from the results of @ref Handler::detect().  This is what
+	 * @ref Handler::detect_intervals() uses, and can be used directly when the frames arrive one at a time, such as
+	 * when each interval needs to be reported as soon as it ends.
+	 *
+	 * ~~~~{.cpp}
+	 * MoveDetect::Handler handler;
+	 * MoveDetect::IntervalTracker tracker;
+	 *
+	 * while (video.read(frame))
+	 * {
+	 *     handler.detect(frame);
+	 *     if (tracker.add(handler))
+	 *     {
+	 *         report(tracker.interval());
+	 *     }
+	 * }
+	 * if (tracker.finish())
+	 * {
+	 *     report(tracker.interval());
+	 * }
+	 * ~~~~
+	 */
+	class IntervalTracker
+	{
+		public:
+
+			/// Constructor.
+			IntervalTracker();
+
+			/// Destructor.
+			virtual ~IntervalTracker();
+
+			/** Add the result of the most recent call to @ref Handler::detect().  The frame index is taken from
+			 * @p handler, so this must be called immediately after @ref Handler::detect().  Frames which were skipped
+			 * (@ref Handler::frame_skipped) extend the interval, but do not have a PSNR of their own.
+			 *
+			 * @return @p true if the previous frame was the last one of an interval, which is then available through
+			 * @ref interval().
+			 */
+			bool add(const Handler & handler);
+
+			/** Close the interval which is still open at the end of the video, if any.
+			 *
+			 * @return @p true if an interval was open, which is then available through @ref interval().
+			 */
+			bool finish();
+
+			/// Determine if the most recent frame had movement, meaning the current interval has not yet ended.
+			bool is_open() const { return interval_is_open; }
+
+			/// The current interval while @ref is_open(), otherwise the interval which most recently ended.
+			const MotionInterval & interval() const { return current; }
+
+		private:
+
+			MotionInterval current;
+
+			bool interval_is_open;
+	};
+}
@@ -0,0 +1,699 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "Kernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MOVEDETECT_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+namespace
+{
+	/* Each SIMD iteration adds at most 4 squared differences (4 * 255 * 255 = 260100) into every 32-bit lane.  To avoid
+	 * overflowing the unsigned 32-bit lanes we spill them into the 64-bit total after this many iterations.
+	 */
+	const size_t iterations_before_spill = 8192;
+
+	/// Number of bytes compared at once in @ref MoveDetect::Kernels::sse_u8_one_to_many().  Must fit in the L1 cache.
+	const size_t one_to_many_block_size = 4096;
+
+	/** Get a scratch buffer with room for at least @p size values.  The buffers passed in are @p thread_local, and only
+	 * ever grow, so once each thread has seen the largest image the kernels no longer allocate anything.
+	 */
+	template <typename T>
+	inline T * scratch(std::vector<T> & buffer, const size_t size)
+	{
+		if (buffer.size() < size)
+		{
+			buffer.resize(size);
+		}
+
+		return buffer.data();
+	}
+
+	/* When "masked" is true, each difference is ANDed with the corresponding byte in "m" before it is squared, so bytes
+	 * where the mask is zero do not contribute to the total.  The mask bytes must be either 0x00 or 0xFF.
+	 */
+	template <bool masked>
+	inline uint64_t sse_scalar(const uint8_t * a, const uint8_t * b, const uint8_t * m, const size_t len)
+	{
+		uint64_t total = 0;
+		for (size_t idx = 0; idx < len; idx ++)
+		{
+			int diff = std::abs(static_cast<int>(a[idx]) - static_cast<int>(b[idx]));
+			if (masked)
+			{
+				diff &= m[idx];
+			}
+			total += static_cast<uint64_t>(diff * diff);
+		}
+
+		return total;
+	}
+
+	inline uint64_t sad_scalar(const uint8_t * a, const uint8_t * b, const size_t len)
+	{
+		uint64_t total = 0;
+		for (size_t idx = 0; idx < len; idx ++)
+		{
+			total += std::abs(static_cast<int>(a[idx]) - static_cast<int>(b[idx]));
+		}
+
+		return total;
+	}
+
+#if defined(__AVX2__)
+
+	template <bool masked>
+	uint64_t sse_simd(const uint8_t * a, const uint8_t * b, const uint8_t * m, const size_t len)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		__m256i total64 = zero;
+
+		size_t idx = 0;
+		while (idx + 32 <= len)
+		{
+			__m256i acc32 = zero;
+			for (size_t iteration = 0; iteration < iterations_before_spill and idx + 32 <= len; iteration ++, idx += 32)
+			{
+				const __m256i va	= _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + idx));
+				const __m256i vb	= _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + idx));
+				__m256i diff		= _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+				if (masked)
+				{
+					diff = _mm256_and_si256(diff, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(m + idx)));
+				}
+				const __m256i lo	= _mm256_unpacklo_epi8(diff, zero);
+				const __m256i hi	= _mm256_unpackhi_epi8(diff, zero);
+				acc32 = _mm256_add_epi32(acc32, _mm256_madd_epi16(lo, lo));
+				acc32 = _mm256_add_epi32(acc32, _mm256_madd_epi16(hi, hi));
+			}
+			total64 = _mm256_add_epi64(total64, _mm256_unpacklo_epi32(acc32, zero));
+			total64 = _mm256_add_epi64(total64, _mm256_unpackhi_epi32(acc32, zero));
+		}
+
+		alignas(32) uint64_t lanes[4];
+		_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), total64);
+
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sse_scalar<masked>(a + idx, b + idx, m + (masked ? idx : 0), len - idx);
+	}
+
+	/// Sum of absolute differences.  The 64-bit lanes cannot overflow, so there is no need to spill.
+	uint64_t sad_simd(const uint8_t * a, const uint8_t * b, const size_t len)
+	{
+		__m256i total64 = _mm256_setzero_si256();
+
+		size_t idx = 0;
+		for (; idx + 32 <= len; idx += 32)
+		{
+			const __m256i va	= _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + idx));
+			const __m256i vb	= _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + idx));
+			total64 = _mm256_add_epi64(total64, _mm256_sad_epu8(va, vb));
+		}
+
+		alignas(32) uint64_t lanes[4];
+		_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), total64);
+
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sad_scalar(a + idx, b + idx, len - idx);
+	}
+
+	/// Add a row of bytes to a row of 32-bit sums.
+	void accumulate_row(const uint8_t * src, uint32_t * acc, const size_t len)
+	{
+		size_t idx = 0;
+		for (; idx + 16 <= len; idx += 16)
+		{
+			const __m128i v		= _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + idx));
+			const __m256i lo	= _mm256_cvtepu8_epi32(v);
+			const __m256i hi	= _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8));
+			__m256i * out		= reinterpret_cast<__m256i *>(acc + idx);
+			_mm256_storeu_si256(out + 0, _mm256_add_epi32(_mm256_loadu_si256(out + 0), lo));
+			_mm256_storeu_si256(out + 1, _mm256_add_epi32(_mm256_loadu_si256(out + 1), hi));
+		}
+		for (; idx < len; idx ++)
+		{
+			acc[idx] += src[idx];
+		}
+
+		return;
+	}
+
+#elif defined(MOVEDETECT_SSE2)
+
+	template <bool masked>
+	uint64_t sse_simd(const uint8_t * a, const uint8_t * b, const uint8_t * m, const size_t len)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i total64 = zero;
+
+		size_t idx = 0;
+		while (idx + 16 <= len)
+		{
+			__m128i acc32 = zero;
+			for (size_t iteration = 0; iteration < iterations_before_spill and idx + 16 <= len; iteration ++, idx += 16)
+			{
+				const __m128i va	= _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + idx));
+				const __m128i vb	= _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + idx));
+				__m128i diff		= _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+				if (masked)
+				{
+					diff = _mm_and_si128(diff, _mm_loadu_si128(reinterpret_cast<const __m128i *>(m + idx)));
+				}
+				const __m128i lo	= _mm_unpacklo_epi8(diff, zero);
+				const __m128i hi	= _mm_unpackhi_epi8(diff, zero);
+				acc32 = _mm_add_epi32(acc32, _mm_madd_epi16(lo, lo));
+				acc32 = _mm_add_epi32(acc32, _mm_madd_epi16(hi, hi));
+			}
+			total64 = _mm_add_epi64(total64, _mm_unpacklo_epi32(acc32, zero));
+			total64 = _mm_add_epi64(total64, _mm_unpackhi_epi32(acc32, zero));
+		}
+
+		alignas(16) uint64_t lanes[2];
+		_mm_store_si128(reinterpret_cast<__m128i *>(lanes), total64);
+
+		return lanes[0] + lanes[1] + sse_scalar<masked>(a + idx, b + idx, m + (masked ? idx : 0), len - idx);
+	}
+
+	/// Sum of absolute differences.  The 64-bit lanes cannot overflow, so there is no need to spill.
+	uint64_t sad_simd(const uint8_t * a, const uint8_t * b, const size_t len)
+	{
+		__m128i total64 = _mm_setzero_si128();
+
+		size_t idx = 0;
+		for (; idx + 16 <= len; idx += 16)
+		{
+			const __m128i va	= _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + idx));
+			const __m128i vb	= _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + idx));
+			total64 = _mm_add_epi64(total64, _mm_sad_epu8(va, vb));
+		}
+
+		alignas(16) uint64_t lanes[2];
+		_mm_store_si128(reinterpret_cast<__m128i *>(lanes), total64);
+
+		return lanes[0] + lanes[1] + sad_scalar(a + idx, b + idx, len - idx);
+	}
+
+	/// Add a row of bytes to a row of 32-bit sums.
+	void accumulate_row(const uint8_t * src, uint32_t * acc, const size_t len)
+	{
+		const __m128i zero = _mm_setzero_si128();
+
+		size_t idx = 0;
+		for (; idx + 16 <= len; idx += 16)
+		{
+			const __m128i v		= _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + idx));
+			const __m128i lo	= _mm_unpacklo_epi8(v, zero);
+			const __m128i hi	= _mm_unpackhi_epi8(v, zero);
+			__m128i * out		= reinterpret_cast<__m128i *>(acc + idx);
+			_mm_storeu_si128(out + 0, _mm_add_epi32(_mm_loadu_si128(out + 0), _mm_unpacklo_epi16(lo, zero)));
+			_mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), _mm_unpackhi_epi16(lo, zero)));
+			_mm_storeu_si128(out + 2, _mm_add_epi32(_mm_loadu_si128(out + 2), _mm_unpacklo_epi16(hi, zero)));
+			_mm_storeu_si128(out + 3, _mm_add_epi32(_mm_loadu_si128(out + 3), _mm_unpackhi_epi16(hi, zero)));
+		}
+		for (; idx < len; idx ++)
+		{
+			acc[idx] += src[idx];
+		}
+
+		return;
+	}
+
+#elif defined(__ARM_NEON)
+
+	template <bool masked>
+	uint64_t sse_simd(const uint8_t * a, const uint8_t * b, const uint8_t * m, const size_t len)
+	{
+		uint64x2_t total64 = vdupq_n_u64(0);
+
+		size_t idx = 0;
+		while (idx + 16 <= len)
+		{
+			uint32x4_t acc32 = vdupq_n_u32(0);
+			for (size_t iteration = 0; iteration < iterations_before_spill and idx + 16 <= len; iteration ++, idx += 16)
+			{
+				uint8x16_t diff = vabdq_u8(vld1q_u8(a + idx), vld1q_u8(b + idx));
+				if (masked)
+				{
+					diff = vandq_u8(diff, vld1q_u8(m + idx));
+				}
+				acc32 = vpadalq_u16(acc32, vmull_u8(vget_low_u8(diff), vget_low_u8(diff)));
+				acc32 = vpadalq_u16(acc32, vmull_u8(vget_high_u8(diff), vget_high_u8(diff)));
+			}
+			total64 = vpadalq_u32(total64, acc32);
+		}
+
+		return vgetq_lane_u64(total64, 0) + vgetq_lane_u64(total64, 1) + sse_scalar<masked>(a + idx, b + idx, m + (masked ? idx : 0), len - idx);
+	}
+
+	/** Sum of absolute differences.  Each iteration adds at most 2 * 255 into every 16-bit lane, so they are spilled into
+	 * the 64-bit total after 128 iterations.
+	 */
+	uint64_t sad_simd(const uint8_t * a, const uint8_t * b, const size_t len)
+	{
+		uint64x2_t total64 = vdupq_n_u64(0);
+
+		size_t idx = 0;
+		while (idx + 16 <= len)
+		{
+			uint16x8_t acc16 = vdupq_n_u16(0);
+			for (size_t iteration = 0; iteration < 128 and idx + 16 <= len; iteration ++, idx += 16)
+			{
+				acc16 = vpadalq_u8(acc16, vabdq_u8(vld1q_u8(a + idx), vld1q_u8(b + idx)));
+			}
+			total64 = vpadalq_u32(total64, vpaddlq_u16(acc16));
+		}
+
+		return vgetq_lane_u64(total64, 0) + vgetq_lane_u64(total64, 1) + sad_scalar(a + idx, b + idx, len - idx);
+	}
+
+	/// Add a row of bytes to a row of 32-bit sums.
+	void accumulate_row(const uint8_t * src, uint32_t * acc, const size_t len)
+	{
+		size_t idx = 0;
+		for (; idx + 16 <= len; idx += 16)
+		{
+			const uint8x16_t v	= vld1q_u8(src + idx);
+			const uint16x8_t lo	= vmovl_u8(vget_low_u8(v));
+			const uint16x8_t hi	= vmovl_u8(vget_high_u8(v));
+			uint32_t * out		= acc + idx;
+			vst1q_u32(out + 0,	vaddw_u16(vld1q_u32(out + 0),	vget_low_u16(lo)));
+			vst1q_u32(out + 4,	vaddw_u16(vld1q_u32(out + 4),	vget_high_u16(lo)));
+			vst1q_u32(out + 8,	vaddw_u16(vld1q_u32(out + 8),	vget_low_u16(hi)));
+			vst1q_u32(out + 12,	vaddw_u16(vld1q_u32(out + 12),	vget_high_u16(hi)));
+		}
+		for (; idx < len; idx ++)
+		{
+			acc[idx] += src[idx];
+		}
+
+		return;
+	}
+
+#else
+
+	template <bool masked>
+	uint64_t sse_simd(const uint8_t * a, const uint8_t * b, const uint8_t * m, const size_t len)
+	{
+		return sse_scalar<masked>(a, b, m, len);
+	}
+
+	uint64_t sad_simd(const uint8_t * a, const uint8_t * b, const size_t len)
+	{
+		return sad_scalar(a, b, len);
+	}
+
+	/// Add a row of bytes to a row of 32-bit sums.
+	void accumulate_row(const uint8_t * src, uint32_t * acc, const size_t len)
+	{
+		for (size_t idx = 0; idx < len; idx ++)
+		{
+			acc[idx] += src[idx];
+		}
+
+		return;
+	}
+
+#endif
+}
+
+
+uint64_t MoveDetect::Kernels::sse_u8(const uint8_t * a, const uint8_t * b, const size_t len)
+{
+	return sse_simd<false>(a, b, nullptr, len);
+}
+
+
+uint64_t MoveDetect::Kernels::sse_u8_masked(const uint8_t * a, const uint8_t * b, const uint8_t * mask, const size_t len)
+{
+	return sse_simd<true>(a, b, mask, len);
+}
+
+
+uint64_t MoveDetect::Kernels::sad_u8(const uint8_t * a, const uint8_t * b, const size_t len)
+{
+	return sad_simd(a, b, len);
+}
+
+
+double MoveDetect::Kernels::psnr_from_sse(const uint64_t sse, const size_t number_of_values)
+{
+	if (sse == 0 or number_of_values == 0)
+	{
+		// identical images -- this matches the original OpenCV sample code where "small values return zero"
+		return 0.0;
+	}
+
+	const double mse	= static_cast<double>(sse) / static_cast<double>(number_of_values);
+	const double psnr	= 10.0 * std::log10((255.0 * 255.0) / mse);
+
+	return psnr;
+}
+
+
+size_t MoveDetect::Kernels::sse_u8_one_to_many(const uint8_t * a, const uint8_t * const * b, const size_t count, const size_t len, const uint64_t limit, uint64_t * results, const uint8_t * mask)
+{
+	std::fill(results, results + count, 0);
+
+	// the mask is optional, so pick the right kernel once instead of for every block
+	auto kernel = [&](const size_t idx, const size_t offset, const size_t block) -> uint64_t
+	{
+		if (mask)
+		{
+			return sse_simd<true>(a + offset, b[idx] + offset, mask + offset, block);
+		}
+		return sse_simd<false>(a + offset, b[idx] + offset, nullptr, block);
+	};
+
+	// The buffers do not all go above the limit in the same block, so a buffer which is found to be above the limit
+	// only stops the ones after it.  The ones before it are still preferred and must be finished.  The buffer found
+	// so far is also finished so the caller gets an accurate value.
+	size_t found = count;
+	for (size_t offset = 0; offset < len; offset += one_to_many_block_size)
+	{
+		const size_t block = std::min(one_to_many_block_size, len - offset);
+		const size_t active = std::min(found + 1, count);
+
+		for (size_t idx = 0; idx < active; idx ++)
+		{
+			results[idx] += kernel(idx, offset, block);
+		}
+
+		for (size_t idx = 0; idx < found; idx ++)
+		{
+			if (results[idx] > limit)
+			{
+				found = idx;
+				break;
+			}
+		}
+	}
+
+	return found;
+}
+
+
+void MoveDetect::Kernels::sse_u8_grid(const uint8_t * a, const uint8_t * b, const uint8_t * mask, const size_t width, const size_t height, const size_t channels, const size_t columns, const size_t rows, uint64_t * results)
+{
+	std::fill(results, results + columns * rows, 0);
+
+	const size_t row_length = width * channels;
+
+	for (size_t cell_row = 0; cell_row < rows; cell_row ++)
+	{
+		uint64_t * cells = results + cell_row * columns;
+		const size_t y1 = cell_row * height / rows;
+		const size_t y2 = (cell_row + 1) * height / rows;
+
+		for (size_t y = y1; y < y2; y ++)
+		{
+			// each row is split into one segment per cell, so the whole image is only read once
+			const size_t offset = y * row_length;
+			for (size_t column = 0; column < columns; column ++)
+			{
+				const size_t x1 = offset + (column * width / columns) * channels;
+				const size_t x2 = offset + ((column + 1) * width / columns) * channels;
+				if (mask)
+				{
+					cells[column] += sse_simd<true>(a + x1, b + x1, mask + x1, x2 - x1);
+				}
+				else
+				{
+					cells[column] += sse_simd<false>(a + x1, b + x1, nullptr, x2 - x1);
+				}
+			}
+		}
+	}
+
+	return;
+}
+
+
+double MoveDetect::Kernels::sse_running_average(const uint8_t * frame, float * mean, float * variance, const uint8_t * mask, uint8_t * previous, const size_t len, const float alpha, const float noise_factor)
+{
+	// The sums are accumulated in blocks of floats to give the compiler independent lanes to vectorize, and each block
+	// is added to the double total so the precision does not degrade on large images.
+	const size_t block_size = 1024;
+	double total = 0.0;
+
+	for (size_t offset = 0; offset < len; offset += block_size)
+	{
+		const size_t end = std::min(len, offset + block_size);
+		float block = 0.0f;
+
+		if (previous)
+		{
+			// copy the average before it is updated, while this block is still in the cache
+			for (size_t idx = offset; idx < end; idx ++)
+			{
+				previous[idx] = static_cast<uint8_t>(std::clamp(mean[idx] + 0.5f, 0.0f, 255.0f));
+			}
+		}
+
+		if (variance)
+		{
+			for (size_t idx = offset; idx < end; idx ++)
+			{
+				const float diff	= static_cast<float>(frame[idx]) - mean[idx];
+				const float excess	= std::max(0.0f, std::abs(diff) - noise_factor * std::sqrt(variance[idx]));
+				const float weight	= (mask ? mask[idx] / 255.0f : 1.0f);
+				block				+= weight * excess * excess;
+				mean[idx]			+= alpha * diff;
+				variance[idx]		= (1.0f - alpha) * (variance[idx] + alpha * diff * diff);
+			}
+		}
+		else
+		{
+			for (size_t idx = offset; idx < end; idx ++)
+			{
+				const float diff	= static_cast<float>(frame[idx]) - mean[idx];
+				const float weight	= (mask ? mask[idx] / 255.0f : 1.0f);
+				block				+= weight * diff * diff;
+				mean[idx]			+= alpha * diff;
+			}
+		}
+
+		total += block;
+	}
+
+	return total;
+}
+
+
+void MoveDetect::Kernels::box_downscale_u8(const uint8_t * src, const size_t src_stride, const size_t src_width, const size_t src_height, const size_t channels, uint8_t * dst, const size_t dst_stride, const size_t dst_width, const size_t dst_height, const size_t first_row, const size_t last_row, const size_t row_step)
+{
+	const size_t step		= std::max<size_t>(1, row_step);
+	const size_t row_length	= src_width * channels;
+
+	// each band of rows is a separate call, usually from a different thread, and this is done for every frame
+	thread_local std::vector<uint32_t> buffer;
+	uint32_t * sums = scratch(buffer, row_length);
+
+	for (size_t y = first_row; y < last_row and y < dst_height; y ++)
+	{
+		const size_t y1 = y * src_height / dst_height;
+		const size_t y2 = std::max(y1 + 1, (y + 1) * src_height / dst_height);
+
+		// vertical pass:  add up all the source rows in this band, which is where almost all of the time is spent
+		std::fill(sums, sums + row_length, 0);
+		size_t number_of_rows = 0;
+		for (size_t row = y1; row < y2; row += step, number_of_rows ++)
+		{
+			accumulate_row(src + row * src_stride, sums, row_length);
+		}
+
+		// horizontal pass:  add up the columns of each block, and divide with rounding
+		uint8_t * out = dst + y * dst_stride;
+		for (size_t x = 0; x < dst_width; x ++)
+		{
+			const size_t x1		= x * src_width / dst_width;
+			const size_t x2		= std::max(x1 + 1, (x + 1) * src_width / dst_width);
+			const uint64_t count	= number_of_rows * (x2 - x1);
+
+			for (size_t c = 0; c < channels; c ++)
+			{
+				uint64_t total = 0;
+				for (size_t column = x1; column < x2; column ++)
+				{
+					total += sums[column * channels + c];
+				}
+				out[x * channels + c] = static_cast<uint8_t>((total + count / 2) / count);
+			}
+		}
+	}
+
+	return;
+}
+
+
+namespace
+{
+	/// Scratch buffers used by @ref morphology_rect(), re-used between calls on the same thread.
+	struct MorphologyBuffers
+	{
+		std::vector<uint8_t> line;
+		std::vector<uint8_t> prefix;
+		std::vector<uint8_t> suffix;
+		std::vector<uint8_t> tmp;
+		std::vector<uint8_t> border_row;
+		std::vector<uint8_t> column_prefix;
+		std::vector<uint8_t> column_suffix;
+	};
+
+	template <bool is_max>
+	inline uint8_t morphology_op(const uint8_t lhs, const uint8_t rhs)
+	{
+		return is_max ? std::max(lhs, rhs) : std::min(lhs, rhs);
+	}
+
+	/* van Herk/Gil-Werman:  the padded line is split into blocks the size of the window.  Within each block we keep a
+	 * running max from the left (prefix) and from the right (suffix).  Any window then covers the end of one block and
+	 * the start of the next, so the result is a single max of one suffix and one prefix, regardless of the window size.
+	 */
+	template <bool is_max>
+	void morphology_rect(const uint8_t * src, const size_t src_stride, uint8_t * dst, const size_t dst_stride, const size_t width, const size_t height, const size_t radius)
+	{
+		// outside the image is ignored, same as the default border used by cv::dilate() and cv::erode()
+		const uint8_t border	= (is_max ? 0 : 255);
+		const size_t window		= 2 * radius + 1;
+
+		// horizontal pass, one row at a time, from src into tmp
+		thread_local MorphologyBuffers buffers;
+		const size_t padded_width	= (width + 2 * radius + window - 1) / window * window;
+		uint8_t * line				= scratch(buffers.line, padded_width);
+		uint8_t * prefix			= scratch(buffers.prefix, padded_width);
+		uint8_t * suffix			= scratch(buffers.suffix, padded_width);
+		uint8_t * tmp				= scratch(buffers.tmp, width * height);
+
+		// the padding on either side of the row is never overwritten
+		std::fill(line, line + padded_width, border);
+
+		for (size_t y = 0; y < height; y ++)
+		{
+			std::copy(src + y * src_stride, src + y * src_stride + width, line + radius);
+
+			for (size_t block = 0; block < padded_width; block += window)
+			{
+				prefix[block] = line[block];
+				for (size_t idx = block + 1; idx < block + window; idx ++)
+				{
+					prefix[idx] = morphology_op<is_max>(prefix[idx - 1], line[idx]);
+				}
+
+				suffix[block + window - 1] = line[block + window - 1];
+				for (size_t idx = block + window - 1; idx > block; idx --)
+				{
+					suffix[idx - 1] = morphology_op<is_max>(suffix[idx], line[idx - 1]);
+				}
+			}
+
+			uint8_t * out = tmp + y * width;
+			for (size_t x = 0; x < width; x ++)
+			{
+				out[x] = morphology_op<is_max>(suffix[x], prefix[x + window - 1]);
+			}
+		}
+
+		// Vertical pass from tmp into dst.  The same thing is done with entire rows instead of single values, which the
+		// compiler can vectorize.  The columns are processed in strips so the prefix and suffix buffers stay small.
+		const size_t padded_height	= (height + 2 * radius + window - 1) / window * window;
+		const size_t strip_width	= std::min<size_t>(width, 512);
+		uint8_t * border_row		= scratch(buffers.border_row, strip_width);
+		uint8_t * column_prefix		= scratch(buffers.column_prefix, padded_height * strip_width);
+		uint8_t * column_suffix		= scratch(buffers.column_suffix, padded_height * strip_width);
+		std::fill(border_row, border_row + strip_width, border);
+
+		for (size_t x1 = 0; x1 < width; x1 += strip_width)
+		{
+			const size_t strip = std::min(strip_width, width - x1);
+
+			auto input_row = [&](const size_t row) -> const uint8_t *
+			{
+				return (row < radius or row >= radius + height) ? border_row : tmp + (row - radius) * width + x1;
+			};
+
+			for (size_t block = 0; block < padded_height; block += window)
+			{
+				std::copy(input_row(block), input_row(block) + strip, column_prefix + block * strip_width);
+				for (size_t row = block + 1; row < block + window; row ++)
+				{
+					const uint8_t * in		= input_row(row);
+					const uint8_t * above	= column_prefix + (row - 1) * strip_width;
+					uint8_t * out			= column_prefix + row * strip_width;
+					for (size_t x = 0; x < strip; x ++)
+					{
+						out[x] = morphology_op<is_max>(above[x], in[x]);
+					}
+				}
+
+				const size_t last = block + window - 1;
+				std::copy(input_row(last), input_row(last) + strip, column_suffix + last * strip_width);
+				for (size_t row = last; row > block; row --)
+				{
+					const uint8_t * in		= input_row(row - 1);
+					const uint8_t * below	= column_suffix + row * strip_width;
+					uint8_t * out			= column_suffix + (row - 1) * strip_width;
+					for (size_t x = 0; x < strip; x ++)
+					{
+						out[x] = morphology_op<is_max>(below[x], in[x]);
+					}
+				}
+			}
+
+			for (size_t y = 0; y < height; y ++)
+			{
+				const uint8_t * lhs	= column_suffix + y * strip_width;
+				const uint8_t * rhs	= column_prefix + (y + window - 1) * strip_width;
+				uint8_t * out		= dst + y * dst_stride + x1;
+				for (size_t x = 0; x < strip; x ++)
+				{
+					out[x] = morphology_op<is_max>(lhs[x], rhs[x]);
+				}
+			}
+		}
+
+		return;
+	}
+}
+
+
+void MoveDetect::Kernels::dilate_rect_u8(const uint8_t * src, const size_t src_stride, uint8_t * dst, const size_t dst_stride, const size_t width, const size_t height, const size_t radius)
+{
+	morphology_rect<true>(src, src_stride, dst, dst_stride, width, height, radius);
+
+	return;
+}
+
+
+void MoveDetect::Kernels::erode_rect_u8(const uint8_t * src, const size_t src_stride, uint8_t * dst, const size_t dst_stride, const size_t width, const size_t height, const size_t radius)
+{
+	morphology_rect<false>(src, src_stride, dst, dst_stride, width, height, radius);
+
+	return;
+}
+
+
+uint64_t MoveDetect::Kernels::sse_limit_from_psnr(const double psnr_threshold, const size_t number_of_values)
+{
+	// psnr < threshold  <==>  mse > 255^2 / 10^(threshold/10)  <==>  sse > values * 255^2 / 10^(threshold/10)
+	const double limit = static_cast<double>(number_of_values) * 255.0 * 255.0 / std::pow(10.0, psnr_threshold / 10.0);
+
+	if (limit >= static_cast<double>(std::numeric_limits<uint64_t>::max()))
+	{
+		return std::numeric_limits<uint64_t>::max();
+	}
+
+	// the sums are integers, so "sse > limit" is the same as "sse > floor(limit)"
+	return static_cast<uint64_t>(std::floor(limit));
+}
@@ -0,0 +1,130 @@
+// MoveDetect -- Library to detect whether movement can be detected between two images or video frames.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace MoveDetect
+{
+	/** Low-level pixel kernels used by @ref MoveDetect::psnr() and @ref MoveDetect::Handler.  These work directly on raw
+	 * 8-bit buffers, never allocate memory, and use SSE2, AVX2, or NEON when the compiler makes them available.  A
+	 * portable scalar version is used on all other platforms.
+	 */
+	namespace Kernels
+	{
+		/** Sum of squared differences between two buffers of 8-bit values.  The number of channels does not matter, since
+		 * every byte is treated as an individual value.
+		 *
+		 * @param [in] a First buffer.
+		 * @param [in] b Second buffer.
+		 * @param [in] len Number of bytes in both buffers.
+		 */
+		uint64_t sse_u8(const uint8_t * a, const uint8_t * b, const size_t len);
+
+		/** Same as @ref sse_u8(), but only the bytes where @p mask is @p 0xFF are included.  The bytes in @p mask must
+		 * be either @p 0x00 or @p 0xFF, and @p mask must be the same length as the other two buffers.
+		 */
+		uint64_t sse_u8_masked(const uint8_t * a, const uint8_t * b, const uint8_t * mask, const size_t len);
+
+		/// Sum of absolute differences between two buffers of 8-bit values.  @see @ref sse_u8()
+		uint64_t sad_u8(const uint8_t * a, const uint8_t * b, const size_t len);
+
+		/** Sum of squared differences between one buffer and several others, reading @p a only once.  The buffers are
+		 * processed in small blocks which stay in the L1 cache while being compared against every buffer in @p b.
+		 *
+		 * After each block, the partial sums are checked against @p limit.  As soon as one of them goes above the limit,
+		 * the buffers after it in @p b are no longer compared.  The buffers before it are still compared until the end,
+		 * since one of them may also go above the limit in a later block, and would then be preferred.
+		 *
+		 * @param [in] a The buffer to compare.
+		 * @param [in] b Array of @p count buffers against which @p a is compared, in order of preference.
+		 * @param [in] count Number of buffers in @p b.
+		 * @param [in] len Number of bytes in @p a and in each of the buffers in @p b.
+		 * @param [in] limit Once a sum of squared differences is greater than this value, stop comparing.
+		 * @param [out] results Array of @p count values where the sums are stored.  The results up to and including the
+		 * returned index are complete, the results after it may only be partial sums.
+		 *
+		 * @param [in] mask Optional mask with the same length as the buffers.  When not @p nullptr, only the bytes where
+		 * the mask is @p 0xFF are included.  @see @ref sse_u8_masked()
+		 *
+		 * @return The lowest index of a buffer in @p b which went above @p limit, or @p count if none of them did.  This is
+		 * always the same as comparing the buffers one at a time, in order, and stopping at the first one above the limit.
+		 */
+		size_t sse_u8_one_to_many(const uint8_t * a, const uint8_t * const * b, const size_t count, const size_t len, const uint64_t limit, uint64_t * results, const uint8_t * mask = nullptr);
+
+		/** Sum of squared differences for each cell of a grid, computed in a single pass over both images.  The cell
+		 * boundaries are at @p (column * width / columns) and @p (row * height / rows), so when the grid does not evenly
+		 * divide the image the cells differ in size by at most 1 pixel.
+		 *
+		 * @param [in] a First image.  Rows must be contiguous.
+		 * @param [in] b Second image, same size and layout as @p a.
+		 * @param [in] mask Optional mask with the same layout as the images.  @see @ref sse_u8_masked()
+		 * @param [in] width Width of the images in pixels.
+		 * @param [in] height Height of the images in pixels.
+		 * @param [in] channels Number of 8-bit values per pixel.
+		 * @param [in] columns Number of cells across.
+		 * @param [in] rows Number of cells down.
+		 * @param [out] results Array of @p columns * @p rows values, stored row by row.
+		 */
+		void sse_u8_grid(const uint8_t * a, const uint8_t * b, const uint8_t * mask, const size_t width, const size_t height, const size_t channels, const size_t columns, const size_t rows, uint64_t * results);
+
+		/** Compare an image against an exponentially weighted running average, and update the running average with the
+		 * image, all in a single pass.  The loop is written without branches so the compiler can vectorize it.
+		 *
+		 * @param [in] frame The new 8-bit image.
+		 * @param [in,out] mean The running average, with one float for every byte in @p frame.
+		 * @param [in,out] variance Optional running variance, same layout as @p mean.  When not @p nullptr, the part of
+		 * each difference which is within @p noise_factor standard deviations is ignored, so pixels which are always
+		 * changing (such as noise, leaves, or water) do not contribute.
+		 * @param [in] mask Optional mask with the same layout as @p frame.  @see @ref sse_u8_masked()
+		 * @param [out] previous Optional 8-bit copy of the running average before it is updated, same layout as @p frame.
+		 * @param [in] len Number of bytes in @p frame.
+		 * @param [in] alpha Weight of the new image when updating the running average, between @p 0.0 and @p 1.0.
+		 * @param [in] noise_factor Number of standard deviations ignored when @p variance is used.
+		 *
+		 * @return The sum of squared differences between @p frame and the running average before it was updated.
+		 */
+		double sse_running_average(const uint8_t * frame, float * mean, float * variance, const uint8_t * mask, uint8_t * previous, const size_t len, const float alpha, const float noise_factor);
+
+		/** Shrink an 8-bit image by averaging blocks of pixels using integer sums.  Each destination pixel is the rounded
+		 * average of the source pixels from @p (x * src_width / dst_width) up to @p ((x + 1) * src_width / dst_width), and
+		 * the same for the rows.  The results only depend on the inputs, so they are identical on every platform.
+		 *
+		 * Only the destination rows from @p first_row up to but not including @p last_row are written, so several threads
+		 * can each work on a different band of rows.  Each source row is read only once.  The destination must not be
+		 * larger than the source.  The row sums are kept in a per-thread buffer which only grows, so nothing is allocated
+		 * once each thread has seen the widest image.
+		 *
+		 * @param [in] row_step Use @p 1 to include every source row.  Larger values only include every Nth row of each
+		 * block, which is faster but approximate.
+		 */
+		void box_downscale_u8(const uint8_t * src, const size_t src_stride, const size_t src_width, const size_t src_height, const size_t channels, uint8_t * dst, const size_t dst_stride, const size_t dst_width, const size_t dst_height, const size_t first_row, const size_t last_row, const size_t row_step = 1);
+
+		/** Dilate a single-channel 8-bit image using a square window of @p (2 * radius + 1) pixels.  This uses the van
+		 * Herk/Gil-Werman algorithm, so the cost does not depend on the size of the window.  Pixels outside the image are
+		 * ignored, which gives the same results as @p cv::dilate() with the default border.  The source and destination
+		 * must not overlap.  The temporary buffers are kept per thread and re-used, the same as @ref box_downscale_u8().
+		 */
+		void dilate_rect_u8(const uint8_t * src, const size_t src_stride, uint8_t * dst, const size_t dst_stride, const size_t width, const size_t height, const size_t radius);
+
+		/// Same as @ref dilate_rect_u8(), but erodes the image.  This gives the same results as @p cv::erode().
+		void erode_rect_u8(const uint8_t * src, const size_t src_stride, uint8_t * dst, const size_t dst_stride, const size_t width, const size_t height, const size_t radius);
+
+		/** Find the largest sum of squared differences which still results in a PSNR at or above @p psnr_threshold.
+		 * Anything greater than the value returned means the PSNR would be below the threshold.
+		 */
+		uint64_t sse_limit_from_psnr(const double psnr_threshold, const size_t number_of_values);
+
+		/** Convert a sum of squared differences into a PSNR value, using the same convention as @ref MoveDetect::psnr():
+		 * identical images return @p 0.0.
+		 *
+		 * @param [in] sse Sum of squared differences.
+		 * @param [in] number_of_values Number of 8-bit values that were compared, meaning pixels multiplied by channels.
+		 */
+		double psnr_from_sse(const uint64_t sse, const size_t number_of_values);
+	}
+}
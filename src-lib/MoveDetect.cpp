@@ -3,7 +3,102 @@
 // MIT license applies.  See "license.txt" for details.
 
 #include "MoveDetect.hpp"
+#include "IntervalTracker.hpp"
+#include "Kernels.hpp"
 #include <algorithm>
+#include <limits>
+
+
+#if MOVEDETECT_INSTRUMENTATION
+#define MOVEDETECT_CONCAT_INNER(a, b) a ## b
+#define MOVEDETECT_CONCAT(a, b) MOVEDETECT_CONCAT_INNER(a, b)
+
+/// Time the rest of the current scope as the given stage.  This only reads the clock if instrumentation is enabled.
+#define MOVEDETECT_TIME_STAGE(s) const StageTimer MOVEDETECT_CONCAT(stage_timer_, __LINE__)(instrumentation_enabled ? &statistics.stage(Stage::s) : nullptr)
+
+/// Update one of the counters in @ref MoveDetect::Statistics if instrumentation is enabled.
+#define MOVEDETECT_COUNT(expr) if (instrumentation_enabled) { expr; }
+#else
+#define MOVEDETECT_TIME_STAGE(s)
+#define MOVEDETECT_COUNT(expr)
+#endif
+
+
+namespace
+{
+	/// Records the time from construction until destruction into the given stage.
+	class StageTimer
+	{
+		public:
+
+			StageTimer(MoveDetect::StageStatistics * s) :
+				stage(s)
+			{
+				if (stage)
+				{
+					start = std::chrono::steady_clock::now();
+				}
+			}
+
+			~StageTimer()
+			{
+				if (stage)
+				{
+					const auto end = std::chrono::steady_clock::now();
+					stage->add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+				}
+			}
+
+		private:
+
+			MoveDetect::StageStatistics * stage;
+			std::chrono::steady_clock::time_point start;
+	};
+
+	/// Convert the differences to greyscale.  Images that are already greyscale are returned as-is.
+	cv::Mat to_greyscale(const cv::Mat & src)
+	{
+		if (src.channels() == 1)
+		{
+			return src;
+		}
+
+		cv::Mat greyscale;
+		cv::cvtColor(src, greyscale, cv::COLOR_BGR2GRAY);
+
+		return greyscale;
+	}
+
+	/// Create a thumbnail of @p src using the given method.  @see @ref MoveDetect::Handler::thumbnail_method
+	void resize_thumbnail(const cv::Mat & src, cv::Mat & dst, const cv::Size & size, const MoveDetect::ThumbnailMethod method, const size_t row_step)
+	{
+		if (method == MoveDetect::ThumbnailMethod::OpenCV or
+			src.depth() != CV_8U or
+			size.width <= 0 or
+			size.height <= 0 or
+			size.width > src.cols or
+			size.height > src.rows)
+		{
+			cv::resize(src, dst, size, 0, 0, cv::INTER_AREA);
+			return;
+		}
+
+		// when the destination is a slot in the control ring buffer, this does not allocate anything
+		dst.create(size, src.type());
+
+		const size_t step = (method == MoveDetect::ThumbnailMethod::IntegerFast ? std::max<size_t>(1, row_step) : 1);
+		cv::parallel_for_(cv::Range(0, size.height),
+			[&](const cv::Range & range)
+			{
+				MoveDetect::Kernels::box_downscale_u8(
+					src.ptr<uint8_t>(), src.step[0], src.cols, src.rows, src.channels(),
+					dst.ptr<uint8_t>(), dst.step[0], dst.cols, dst.rows,
+					range.start, range.end, step);
+			});
+
+		return;
+	}
+}
 
 
 double MoveDetect::psnr(const cv::Mat & src, const cv::Mat & dst)
@@ -20,12 +115,23 @@ double MoveDetect::psnr(const cv::Mat & src, const cv::Mat & dst)
 		throw std::invalid_argument("src and dst images cannot be compared");
 	}
 
+	if (src.depth() == CV_8U and (src.channels() == 1 or src.channels() == 3))
+	{
+		// fast path:  single pass over both images with integer accumulators and no temporary images
+		return Kernels::psnr_from_sse(sse(src, dst), src.channels() * src.total());
+	}
+
 	cv::Mat s1;
 	cv::absdiff(src, dst, s1);	// |src - dst|
 	s1.convertTo(s1, CV_32F);	// cannot make a square on 8 bits
 	s1 = s1.mul(s1);			// |src - dst|^2
 	cv::Scalar s = sum(s1);		// sum elements per channel
-	const double sse = s.val[0] + s.val[1] + s.val[2]; // sum channels
+
+	double sse = 0.0;
+	for (int idx = 0; idx < std::min(src.channels(), 4); idx ++)
+	{
+		sse += s.val[idx];		// sum channels
+	}
 
 	if (sse <= 1e-10)			// for small values return zero
 	{
@@ -39,40 +145,119 @@ double MoveDetect::psnr(const cv::Mat & src, const cv::Mat & dst)
 }
 
 
+uint64_t MoveDetect::sse(const cv::Mat & src, const cv::Mat & dst)
+{
+	if (src.type() != dst.type() ||
+		src.cols != dst.cols ||
+		src.rows != dst.rows ||
+		src.depth() != CV_8U)
+	{
+		throw std::invalid_argument("src and dst images cannot be compared");
+	}
+
+	const size_t row_length = src.cols * src.channels();
+
+	if (src.isContinuous() and dst.isContinuous())
+	{
+		return Kernels::sse_u8(src.ptr<uint8_t>(), dst.ptr<uint8_t>(), row_length * src.rows);
+	}
+
+	uint64_t total = 0;
+	for (int y = 0; y < src.rows; y ++)
+	{
+		total += Kernels::sse_u8(src.ptr<uint8_t>(y), dst.ptr<uint8_t>(y), row_length);
+	}
+
+	return total;
+}
+
+
 cv::Mat MoveDetect::simple_colour_balance(const cv::Mat & src)
 {
-	if (src.empty() || src.channels() != 3)
+	return simple_colour_balance(src, simple_colour_balance_lut(src));
+}
+
+
+cv::Mat MoveDetect::simple_colour_balance(const cv::Mat & src, const cv::Mat & lut)
+{
+	if (src.empty() or lut.total() != 256 or lut.channels() != src.channels())
 	{
 		throw std::invalid_argument("cannot colour balance the given image");
 	}
 
+	cv::Mat output;
+	cv::LUT(src, lut, output);
+
+	return output;
+}
+
+
+cv::Mat MoveDetect::simple_colour_balance_lut(const cv::Mat & src)
+{
+	if (src.empty() or src.depth() != CV_8U or (src.channels() != 1 and src.channels() != 3))
+	{
+		throw std::invalid_argument("cannot colour balance the given image");
+	}
+
+	const int channels = src.channels();
+
+	// single pass over the image to build a histogram for each channel
+	std::vector<size_t> histogram(256 * channels, 0);
+	for (int y = 0; y < src.rows; y ++)
+	{
+		const uint8_t * ptr = src.ptr<uint8_t>(y);
+		for (int x = 0; x < src.cols; x ++)
+		{
+			for (int c = 0; c < channels; c ++)
+			{
+				histogram[256 * c + ptr[c]] ++;
+			}
+			ptr += channels;
+		}
+	}
+
 	const float full_percent = 1.0;
 	const float half_percent = full_percent / 200.0f;
 
-	std::vector<cv::Mat> tmpsplit;
-	cv::split(src, tmpsplit);
+	// These are the same positions the original implementation used to index into the sorted pixel values.
+	const size_t number_of_pixels	= src.total();
+	const size_t lo_position		= cvFloor(((float)number_of_pixels) * (0.0 + half_percent));
+	const size_t hi_position		= std::min(number_of_pixels - 1, static_cast<size_t>(cvCeil(((float)number_of_pixels) * (1.0 - half_percent))));
+
+	cv::Mat lut(1, 256, CV_8UC(channels));
+	uint8_t * table = lut.ptr<uint8_t>();
 
-	for(size_t idx = 0; idx < 3; idx ++)
+	for (int c = 0; c < channels; c ++)
 	{
 		// find the low and high precentile values (based on the input percentile)
-		cv::Mat flat;
-		tmpsplit[idx].reshape(1,1).copyTo(flat);
-		cv::sort(flat, flat, cv::SORT_EVERY_ROW + cv::SORT_ASCENDING);
-		const int lo = flat.at<uchar>(cvFloor(((float)flat.cols) * (0.0 + half_percent)));
-		const int hi = flat.at<uchar>( cvCeil(((float)flat.cols) * (1.0 - half_percent)));
-
-		// saturate below the low percentile and above the high percentile
-		tmpsplit[idx].setTo(lo, tmpsplit[idx] < lo);
-		tmpsplit[idx].setTo(hi, tmpsplit[idx] > hi);
+		const size_t * h = &histogram[256 * c];
+		int lo = -1;
+		int hi = -1;
+		size_t cumulative = 0;
+		for (int value = 0; value < 256 and hi < 0; value ++)
+		{
+			cumulative += h[value];
+			if (lo < 0 and cumulative > lo_position)
+			{
+				lo = value;
+			}
+			if (cumulative > hi_position)
+			{
+				hi = value;
+			}
+		}
 
-		// scale the channel
-		cv::normalize(tmpsplit[idx], tmpsplit[idx], 0, 255, cv::NORM_MINMAX);
+		// saturate below the low percentile and above the high percentile, then scale to 0-255 the same way that
+		// cv::normalize() with NORM_MINMAX would have done
+		const double scale = (hi > lo ? 255.0 / (hi - lo) : 0.0);
+		for (int value = 0; value < 256; value ++)
+		{
+			const int saturated = std::clamp(value, lo, hi);
+			table[value * channels + c] = cv::saturate_cast<uint8_t>((saturated - lo) * scale);
+		}
 	}
 
-	cv::Mat output;
-	cv::merge(tmpsplit, output);
-
-	return output;
+	return lut;
 }
 
 
@@ -107,18 +292,79 @@ MoveDetect::Handler & MoveDetect::Handler::clear()
 	number_of_control_frames	= 4;
 	psnr_threshold				= 32.0;
 	most_recent_psnr_score		= 0.0;
+	engine						= Engine::ControlFrames;
+	running_average_alpha		= 0.05;
+	running_average_variance_enabled	= false;
+	running_average_noise_factor		= 2.0;
+	background_mean				= cv::Mat();
+	background_variance			= cv::Mat();
+	background					= cv::Mat();
+	grid_enabled				= false;
+	grid_size					= cv::Size(4, 4);
+	grid_psnr_threshold			= 32.0;
+	grid_scores					= cv::Mat();
 	thumbnail_ratio				= 0.05;
 	thumbnail_size				= cv::Size(0, 0);
+	thumbnail_method			= ThumbnailMethod::OpenCV;
+	thumbnail_row_step			= 2;
+	cascade_enabled				= false;
+	cascade_ratio				= 0.25;
+	cascade_band				= 4.0;
+	cascade_psnr_offset			= 6.0;
+	coarse_control.clear();
 	frame_index_with_movement	= 0;
 	movement_last_detected		= std::chrono::high_resolution_clock::time_point();
 	mask_enabled				= false;
 	mask						= cv::Mat();
+	lazy_evaluation				= false;
+	mask_low_resolution			= false;
+	morphology_shape			= cv::MORPH_RECT;
+	morphology_size				= 3;
+	morphology_iterations		= 10;
 	line_type					= cv::LINE_4;
 	contours_enabled			= false;
 	contours_size				= 1;
 	bbox_enabled				= false;
 	bbox_size					= 1;
 	output						= cv::Mat();
+	last_image					= cv::Mat();
+	differences					= cv::Mat();
+	contours.clear();
+	bbox						= cv::Rect();
+	mask_is_blank				= false;
+	mask_is_valid				= false;
+	contours_are_valid			= false;
+	bbox_is_valid				= false;
+	output_is_valid				= false;
+	regions.clear();
+	regions_are_valid			= false;
+	region_minimum_area			= 0;
+	colour_balance_enabled		= false;
+	colour_balance_frequency	= 30;
+	colour_balance_lut			= cv::Mat();
+	colour_balance_next_frame	= 0;
+	colour_balanced				= cv::Mat();
+	adaptive_enabled			= false;
+	adaptive_maximum_interval	= 8;
+	adaptive_stable_time		= std::chrono::seconds(5);
+	adaptive_psnr_margin		= 3.0;
+	adaptive_interval			= 1;
+	adaptive_reason				= AdaptiveReason::Disabled;
+	frame_skipped				= false;
+	adaptive_next_frame			= 0;
+	adaptive_previous_psnr		= 0.0;
+	instrumentation_enabled		= false;
+	statistics.reset();
+	regions_of_interest.clear();
+	exclusion_zones.clear();
+	zone_mask					= cv::Mat();
+	zone_mask_values			= 0;
+	zone_mask_image_size		= cv::Size(0, 0);
+	zone_mask_is_valid			= false;
+	coarse_zone_mask			= cv::Mat();
+	coarse_zone_mask_values		= 0;
+	shared_comparisons			= nullptr;
+	share_thumbnails			= false;
 
 	return *this;
 }
@@ -132,128 +378,1195 @@ bool MoveDetect::Handler::detect(cv::Mat & next_image)
 
 bool MoveDetect::Handler::detect(const size_t frame_index, cv::Mat & image)
 {
-	if (image.empty())
+	return process(frame_index, image, nullptr);
+}
+
+
+bool MoveDetect::Handler::detect(const size_t frame_index, cv::Mat & image, const cv::Mat & thumbnail)
+{
+	if (thumbnail.empty())
 	{
-		throw std::invalid_argument("cannot detect using an empty image");
+		throw std::invalid_argument("cannot detect using an empty thumbnail");
 	}
 
-	if (thumbnail_size.area() <= 1)
+	return process(frame_index, image, &thumbnail);
+}
+
+
+MoveDetect::MotionIntervals MoveDetect::Handler::detect_intervals(const std::vector<cv::Mat> & frames)
+{
+	MotionIntervals intervals;
+	IntervalTracker tracker;
+
+	// the mask and output are not needed to find the intervals
+	const bool previous_lazy_evaluation = lazy_evaluation;
+	lazy_evaluation = true;
+
+	try
 	{
-		// we need to figure out a decent width and height to use for the thumbnails
-		thumbnail_ratio			= std::clamp(thumbnail_ratio, 0.01, 1.0);
-		thumbnail_size.width	= image.cols * thumbnail_ratio;
-		thumbnail_size.height	= image.rows * thumbnail_ratio;
+		detect_batch(next_frame_index, frames, tracker, intervals);
 	}
+	catch (...)
+	{
+		lazy_evaluation = previous_lazy_evaluation;
+		throw;
+	}
+	lazy_evaluation = previous_lazy_evaluation;
 
-	if (contours_enabled or bbox_enabled)
+	if (tracker.finish())
 	{
-		// bounding box requires the mask to be created
-		mask_enabled = true;
+		intervals.push_back(tracker.interval());
 	}
 
-	cv::Mat scb = image; //simple_colour_balance(image);
-	cv::Mat thumbnail;
-	cv::resize(scb, thumbnail, thumbnail_size, 0, 0, cv::INTER_AREA);
+	return intervals;
+}
 
-	// Now compare this image against all the other control images we've kept.
-	//
-	// Do the comparison in reverse order, starting with the most recent thumbnail
-	// since if there was movement, that would be the first place we'd detect it.
-	const bool previous_movement_detected = movement_detected;
-	movement_detected = false;
-	for (auto iter = control.rbegin(); iter != control.rend(); iter ++)
+
+MoveDetect::MotionIntervals MoveDetect::Handler::detect_intervals(cv::VideoCapture & video, const size_t first_frame, const size_t last_frame)
+{
+	if (video.isOpened() == false)
 	{
-//		const auto & key = iter->first;		// the index value
-		const auto & val = iter->second;	// the stored thumbnail for the given index
+		throw std::invalid_argument("cannot detect intervals using a video which is not opened");
+	}
 
-		most_recent_psnr_score = psnr(val, thumbnail);
-		if (most_recent_psnr_score < psnr_threshold)
-		{
-			movement_detected = true;
-			movement_last_detected = std::chrono::high_resolution_clock::now();
-			frame_index_with_movement = frame_index;
+	if (first_frame > 0)
+	{
+		video.set(cv::CAP_PROP_POS_FRAMES, first_frame);
+	}
 
-			if (mask_enabled)
-			{
-				cv::Mat differences;
-				cv::absdiff(val, thumbnail, differences);
+	MotionIntervals intervals;
+	IntervalTracker tracker;
 
-				// This gives us a very tiny 3-channel image.
-				// Now resize it to match the original image size.
+	// the mask and output are not needed to find the intervals
+	const bool previous_lazy_evaluation = lazy_evaluation;
+	lazy_evaluation = true;
 
-				cv::Mat differences_resized;
-				cv::resize(differences, differences_resized, image.size(), 0, 0, cv::INTER_CUBIC);
+	// Decoding is sequential, so a few frames are decoded for each thread, then thumbnailed in parallel.  The images
+	// are re-used between groups so OpenCV can decode into the same buffers.
+	const size_t frames_per_batch = 2 * std::max(1, cv::getNumThreads());
+	std::vector<cv::Mat> frames(frames_per_batch);
 
-				// We'd like to generate a binary threshold, but that requires us to convert
-				// the image to greyscale first.
-				cv::Mat greyscale;
-				cv::cvtColor(differences_resized, greyscale, cv::COLOR_BGR2GRAY);
-				cv::Mat threshold;
-				cv::threshold(greyscale, threshold, 0.0, 255.0, cv::THRESH_BINARY | cv::THRESH_OTSU);
+	try
+	{
+		size_t frame_index = first_frame;
+		while (frame_index <= last_frame)
+		{
+			size_t count = 0;
+			while (count < frames_per_batch and frame_index + count <= last_frame and video.read(frames[count]))
+			{
+				count ++;
+			}
 
-				// And finally we dilate + erode the results to combine regions.
-				cv::Mat dilated;
-				cv::dilate(threshold, dilated, cv::Mat(), cv::Point(-1, -1), 10);
-				cv::Mat eroded;
-				cv::erode(dilated, eroded, cv::Mat(), cv::Point(-1, -1), 10);
+			if (count == 0)
+			{
+				break;
+			}
 
-				mask = eroded;
+			if (count < frames_per_batch)
+			{
+				frames.resize(count);
 			}
 
-			break;
+			detect_batch(frame_index, frames, tracker, intervals);
+			frame_index += count;
+
+			if (count < frames_per_batch)
+			{
+				// end of the video
+				break;
+			}
 		}
 	}
+	catch (...)
+	{
+		lazy_evaluation = previous_lazy_evaluation;
+		throw;
+	}
+	lazy_evaluation = previous_lazy_evaluation;
+
+	if (tracker.finish())
+	{
+		intervals.push_back(tracker.interval());
+	}
+
+	// the frame buffers are re-used while decoding, so the last image no longer holds the pixels that were analyzed
+	last_image = cv::Mat();
+
+	return intervals;
+}
 
-	transition_detected = (previous_movement_detected != movement_detected);
 
-	if (mask_enabled)
+void MoveDetect::Handler::detect_batch(const size_t first_frame_index, const std::vector<cv::Mat> & frames, IntervalTracker & tracker, MotionIntervals & intervals)
+{
+	const size_t count = frames.size();
+
+	// Work out which frames need a new colour balancing lookup table using the same rules as detect(), so the results
+	// are identical.  Only those frames have their histograms calculated, and every other frame re-uses the table
+	// from the most recent one.
+	std::vector<cv::Mat> luts(count);
+	std::vector<size_t> lut_frames;
+	if (colour_balance_enabled)
 	{
-		// if the caller is expecting a mask, but we have no movement then reset the mask to a "blank" image
-		if (mask.empty() or (transition_detected and movement_detected == false))
+		size_t next = colour_balance_next_frame;
+		int channels = colour_balance_lut.empty() ? -1 : colour_balance_lut.channels();
+		for (size_t idx = 0; idx < count; idx ++)
 		{
-			mask = cv::Mat(image.size(), CV_8UC1, {0, 0, 0});
+			const cv::Mat & frame = frames[idx];
+			if (frame.depth() == CV_8U and (frame.channels() == 1 or frame.channels() == 3) and
+				(channels != frame.channels() or first_frame_index + idx >= next))
+			{
+				lut_frames.push_back(idx);
+				next		= first_frame_index + idx + std::max<size_t>(1, colour_balance_frequency);
+				channels	= frame.channels();
+			}
 		}
 
-		if (contours_enabled or bbox_enabled)
-		{
-			output = image.clone();
-
-			if (contours_enabled)
+		cv::parallel_for_(cv::Range(0, lut_frames.size()),
+			[&](const cv::Range & range)
 			{
-				typedef std::vector<cv::Point> Contour;
-				typedef std::vector<Contour> VContours;
-				typedef std::vector<cv::Vec4i> Hierarchy;
-
-				VContours contours;
-				Hierarchy hierarchy;
-				cv::findContours(mask, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-				for (auto & contour : contours)
+				for (int idx = range.start; idx < range.end; idx ++)
 				{
-					cv::polylines(output, contour, true, {0, 0, 255}, contours_size, line_type);
+					luts[lut_frames[idx]] = simple_colour_balance_lut(frames[lut_frames[idx]]);
 				}
-				
+			});
+
+		cv::Mat lut = colour_balance_lut;
+		for (size_t idx = 0; idx < count; idx ++)
+		{
+			const cv::Mat & frame = frames[idx];
+			if (luts[idx].empty() == false)
+			{
+				lut = luts[idx];
+			}
+			else if (frame.depth() == CV_8U and (frame.channels() == 1 or frame.channels() == 3))
+			{
+				luts[idx] = lut;
 			}
+		}
+
+		// remember where we are for the next batch, or the next call to detect()
+		colour_balance_lut			= lut;
+		colour_balance_next_frame	= next;
+	}
 
-			if (bbox_enabled)
+	std::vector<cv::Mat> thumbnails(count);
+	cv::parallel_for_(cv::Range(0, count),
+		[&](const cv::Range & range)
+		{
+			for (int idx = range.start; idx < range.end; idx ++)
 			{
-				cv::rectangle(output, cv::boundingRect(mask), {0, 255, 255}, bbox_size, line_type);
+				thumbnails[idx] = create_thumbnail(frames[idx], luts[idx]);
 			}
+		});
+
+	for (size_t idx = 0; idx < count; idx ++)
+	{
+		const size_t frame_index = first_frame_index + idx;
+
+		cv::Mat frame = frames[idx];
+		detect(frame_index, frame, thumbnails[idx]);
+
+		if (tracker.add(*this))
+		{
+			intervals.push_back(tracker.interval());
 		}
 	}
 
-	// see if we need to keep this image as a "key" frame
-	if (frame_index >= next_key_frame or control.size() < number_of_control_frames)
+	return;
+}
+
+
+cv::Mat MoveDetect::Handler::create_thumbnail(const cv::Mat & image, const cv::Mat & lut) const
+{
+	if (image.empty())
+	{
+		throw std::invalid_argument("cannot create a thumbnail using an empty image");
+	}
+
+	// same size as detect() would use, but without modifying this object
+	cv::Size size = thumbnail_size;
+	if (size.area() <= 1)
+	{
+		const double ratio	= std::clamp(thumbnail_ratio, 0.01, 1.0);
+		size.width			= image.cols * ratio;
+		size.height			= image.rows * ratio;
+	}
+
+	cv::Mat scb = image;
+	if (lut.empty() == false)
+	{
+		scb = simple_colour_balance(image, lut);
+	}
+
+	cv::Mat thumbnail;
+	resize_thumbnail(scb, thumbnail, size, thumbnail_method, thumbnail_row_step);
+
+	return thumbnail;
+}
+
+
+bool MoveDetect::Handler::process(const size_t frame_index, cv::Mat & image, const cv::Mat * precomputed_thumbnail)
+{
+	if (image.empty())
+	{
+		throw std::invalid_argument("cannot detect using an empty image");
+	}
+
+	MOVEDETECT_TIME_STAGE(Detect);
+	MOVEDETECT_COUNT(statistics.frames ++);
+
+	if (adaptive_enabled and adaptive_interval > 1 and frame_index < adaptive_next_frame and control.empty() == false)
+	{
+		// The scene has been stable long enough that we're only looking at every Nth frame.  Nothing is updated other
+		// than the frame index, so the mask and output still refer to the last frame that was analyzed.
+		frame_skipped		= true;
+		transition_detected	= false;
+		next_frame_index	= frame_index + 1;
+		MOVEDETECT_COUNT(statistics.frames_skipped ++);
+
+		return movement_detected;
+	}
+	frame_skipped = false;
+
+	if (thumbnail_size.area() <= 1 and precomputed_thumbnail)
+	{
+		thumbnail_size = precomputed_thumbnail->size();
+	}
+	else if (thumbnail_size.area() <= 1)
+	{
+		// we need to figure out a decent width and height to use for the thumbnails
+		thumbnail_ratio			= std::clamp(thumbnail_ratio, 0.01, 1.0);
+		thumbnail_size.width	= image.cols * thumbnail_ratio;
+		thumbnail_size.height	= image.rows * thumbnail_ratio;
+	}
+
+	if (contours_enabled or bbox_enabled)
+	{
+		// bounding box requires the mask to be created
+		mask_enabled = true;
+	}
+
+	// The new thumbnail is resized directly into the next slot of the ring buffer.  If this frame is not kept as a key
+	// frame, then the slot will be reused for the next frame.  The running average only needs the latest thumbnail.
+	const size_t controls_needed = (engine == Engine::RunningAverage ? 1 : number_of_control_frames);
+	MOVEDETECT_COUNT(statistics.image_reallocations += (control.capacity() != controls_needed or control.thumbnail_size() != thumbnail_size or control.thumbnail_type() != image.type() ? 1 : 0));
+	control.reserve(controls_needed, thumbnail_size, image.type());
+
+	// the small thumbnails are only kept while the cascade is in use, otherwise they would refer to old key frames
+	const bool use_cascade = (cascade_enabled and engine == Engine::ControlFrames and grid_enabled == false and precomputed_thumbnail == nullptr);
+	const cv::Size coarse_size = (use_cascade ? cascade_size() : cv::Size(0, 0));
+	if (use_cascade)
+	{
+		MOVEDETECT_COUNT(statistics.image_reallocations += (coarse_control.capacity() != controls_needed or coarse_control.thumbnail_size() != coarse_size or coarse_control.thumbnail_type() != image.type() ? 1 : 0));
+		coarse_control.reserve(controls_needed, coarse_size, image.type());
+	}
+	else if (coarse_control.capacity() > 0)
+	{
+		coarse_control.clear();
+	}
+
+	update_zone_mask(image.size(), image.type());
+
+	if (precomputed_thumbnail and (precomputed_thumbnail->size() != thumbnail_size or precomputed_thumbnail->type() != image.type()))
+	{
+		throw std::invalid_argument("thumbnail does not match the thumbnail size or the image type");
+	}
+
+	cv::Mat scb = image;
+	if (precomputed_thumbnail == nullptr and colour_balance_enabled and (image.depth() == CV_8U and (image.channels() == 1 or image.channels() == 3)))
 	{
-		control[frame_index] = thumbnail;
-		while (control.size() > number_of_control_frames)
+		MOVEDETECT_TIME_STAGE(ColourBalance);
+
+		// the histogram is only needed every few frames, but the lookup table is applied to every frame
+		if (colour_balance_lut.empty() or colour_balance_lut.channels() != image.channels() or frame_index >= colour_balance_next_frame)
 		{
-			auto iter = control.begin();
-			control.erase(iter);
+			colour_balance_lut			= simple_colour_balance_lut(image);
+			colour_balance_next_frame	= frame_index + std::max<size_t>(1, colour_balance_frequency);
+			MOVEDETECT_COUNT(statistics.image_reallocations ++);
 		}
-		next_key_frame = frame_index + key_frame_frequency;
+		[[maybe_unused]] const uchar * previous_data = colour_balanced.data;
+		cv::LUT(image, colour_balance_lut, colour_balanced);
+		MOVEDETECT_COUNT(statistics.image_reallocations += (colour_balanced.data != previous_data ? 1 : 0));
+		scb = colour_balanced;
 	}
 
-	next_frame_index = frame_index + 1;
+	const bool previous_movement_detected = movement_detected;
+	movement_detected = false;
 
-	return movement_detected;
+	// The running average is updated with every frame, so control always holds the most recent thumbnail in that mode.
+	const bool key_frame = (engine == Engine::RunningAverage or frame_index >= next_key_frame or control.size() < controls_needed);
+	const cv::Mat * movement_control = nullptr;
+	bool fine_compare_needed = true;
+
+	const cv::Mat * coarse_thumbnail = nullptr;
+	const double coarse_threshold = psnr_threshold + cascade_psnr_offset;
+	if (use_cascade)
+	{
+		cv::Mat & coarse = coarse_control.next();
+		{
+			MOVEDETECT_TIME_STAGE(Thumbnail);
+			resize_thumbnail(scb, coarse, coarse_size, thumbnail_method, thumbnail_row_step);
+		}
+		{
+			MOVEDETECT_TIME_STAGE(Compare);
+			movement_control = compare(coarse_control, coarse, coarse_zone_mask, coarse_zone_mask_values, coarse_threshold, false);
+		}
+		coarse_thumbnail = &coarse;
+
+		// Until both ring buffers hold the same key frames, such as after the cascade is enabled or a snapshot is
+		// loaded, the small thumbnails cannot be trusted to make a decision on their own.
+		fine_compare_needed =
+			std::abs(most_recent_psnr_score - coarse_threshold) < cascade_band or
+			coarse_control.size() != control.size();
+		MOVEDETECT_COUNT(statistics.coarse_decisions += (fine_compare_needed ? 0 : 1));
+
+		// The small thumbnails score higher than the full-size thumbnails, so when they make the decision the score is
+		// moved back to the scale of psnr_threshold for the adaptive interval and anyone else reading it.  Zero means the
+		// images are identical and is left as-is.
+		if (fine_compare_needed == false and most_recent_psnr_score != 0.0)
+		{
+			most_recent_psnr_score -= cascade_psnr_offset;
+		}
+	}
+
+	// When the thumbnails are shared with other handlers, a key frame refers to the same pixels rather than a copy.
+	const bool share_thumbnail = (precomputed_thumbnail != nullptr and share_thumbnails);
+	cv::Mat shared_thumbnail;
+	if (share_thumbnail)
+	{
+		shared_thumbnail = *precomputed_thumbnail;
+	}
+
+	// key frames always need the full-size thumbnail since it is stored in the ring buffer
+	cv::Mat & thumbnail = (share_thumbnail ? shared_thumbnail : control.next());
+	if (share_thumbnail == false and (fine_compare_needed or key_frame))
+	{
+		MOVEDETECT_TIME_STAGE(Thumbnail);
+		if (precomputed_thumbnail)
+		{
+			precomputed_thumbnail->copyTo(thumbnail);
+		}
+		else
+		{
+			resize_thumbnail(scb, thumbnail, thumbnail_size, thumbnail_method, thumbnail_row_step);
+		}
+	}
+
+	if (fine_compare_needed)
+	{
+		MOVEDETECT_TIME_STAGE(Compare);
+		movement_control = (engine == Engine::RunningAverage ? compare_running_average(thumbnail) : compare(control, thumbnail, zone_mask, zone_mask_values, psnr_threshold, grid_enabled));
+	}
+
+	// Anything derived from the mask is computed on demand.  All we keep is the tiny thumbnail-sized differences and a
+	// reference to the image, which is enough to create the mask, contours, bounding box, and output when requested.
+	last_image			= image;
+	mask_is_valid		= false;
+	contours_are_valid	= false;
+	bbox_is_valid		= false;
+	output_is_valid		= false;
+	regions_are_valid	= false;
+
+	if (movement_control)
+	{
+		movement_detected = true;
+		movement_last_detected = std::chrono::high_resolution_clock::now();
+		frame_index_with_movement = frame_index;
+
+		// when the decision was made using the small thumbnails, the mask is also created from the small thumbnails
+		const cv::Mat & moving_thumbnail	= (fine_compare_needed ? thumbnail : *coarse_thumbnail);
+		const cv::Mat & moving_zones		= (fine_compare_needed ? zone_mask : coarse_zone_mask);
+
+		[[maybe_unused]] const uchar * previous_data = differences.data;
+		cv::absdiff(*movement_control, moving_thumbnail, differences);
+		if (moving_zones.empty() == false)
+		{
+			// excluded pixels must not show up in the mask, contours, or regions
+			cv::bitwise_and(differences, moving_zones, differences);
+		}
+		MOVEDETECT_COUNT(statistics.image_reallocations += (differences.data != previous_data ? 1 : 0));
+		MOVEDETECT_COUNT(statistics.frames_with_movement ++);
+	}
+
+	transition_detected = (previous_movement_detected != movement_detected);
+
+	if (movement_detected == false and mask_is_blank and mask.size() == image.size())
+	{
+		// the previous mask was already blank, no need to create a new one
+		mask_is_valid = true;
+	}
+
+	if (lazy_evaluation == false and mask_enabled)
+	{
+		get_mask();
+
+		if (contours_enabled or bbox_enabled)
+		{
+			get_output();
+		}
+	}
+
+	// see if we need to keep this image as a "key" frame
+	if (key_frame)
+	{
+		if (share_thumbnail)
+		{
+			control.share(frame_index, thumbnail);
+		}
+		else
+		{
+			control.push(frame_index);
+		}
+		if (use_cascade)
+		{
+			coarse_control.push(frame_index);
+		}
+		next_key_frame = frame_index + key_frame_frequency;
+		MOVEDETECT_COUNT(statistics.key_frames_inserted ++);
+	}
+
+	update_adaptive_interval(frame_index);
+
+	next_frame_index = frame_index + 1;
+
+	return movement_detected;
+}
+
+
+bool MoveDetect::Handler::detect(const PixelFormat format, const uint8_t * data, const int width, const int height, const size_t stride)
+{
+	return detect(next_frame_index, format, data, width, height, stride);
+}
+
+
+bool MoveDetect::Handler::detect(const size_t frame_index, const PixelFormat format, const uint8_t * data, const int width, const int height, const size_t stride)
+{
+	if (data == nullptr or width <= 0 or height <= 0)
+	{
+		throw std::invalid_argument("cannot detect using an empty image buffer");
+	}
+
+	const int type = (format == PixelFormat::BGR ? CV_8UC3 : CV_8UC1);
+	const size_t minimum_stride = width * CV_ELEM_SIZE(type);
+	if (stride != 0 and stride < minimum_stride)
+	{
+		throw std::invalid_argument("stride is smaller than the image width");
+	}
+
+	// This is only a header which points to the caller's buffer -- nothing is copied.  The Y plane of the YUV formats
+	// is always the first "height" rows of the buffer, so the chroma planes are never touched.
+	cv::Mat image(height, width, type, const_cast<uint8_t *>(data), stride == 0 ? minimum_stride : stride);
+
+	return detect(frame_index, image);
+}
+
+
+const cv::Mat * MoveDetect::Handler::compare(const ControlMap & control_map, const cv::Mat & thumbnail, const cv::Mat & zones, const size_t zone_values, const double threshold, const bool use_grid)
+{
+	// Now compare this image against all the other control images we've kept.
+	//
+	// Do the comparison in reverse order, starting with the most recent thumbnail
+	// since if there was movement, that would be the first place we'd detect it.
+	const size_t number_of_controls = control_map.size();
+	cv::AutoBuffer<const cv::Mat *> controls(number_of_controls);
+	cv::AutoBuffer<const uint8_t *> pointers(number_of_controls);
+	cv::AutoBuffer<uint64_t> results(number_of_controls);
+
+	const bool use_zones = (zones.empty() == false);
+	if (use_zones and zone_values == 0)
+	{
+		// everything has been excluded so there is nothing to compare
+		most_recent_psnr_score = 0.0;
+		MOVEDETECT_COUNT(statistics.last_control_frames_compared = 0);
+
+		return nullptr;
+	}
+
+	cv::AutoBuffer<size_t> frame_indexes(number_of_controls);
+	bool all_continuous = thumbnail.isContinuous() and thumbnail.depth() == CV_8U;
+	size_t idx = 0;
+	for (auto iter = control_map.rbegin(); iter != control_map.rend(); iter ++, idx ++)
+	{
+		const auto & val = iter->second;	// the stored thumbnail for the given index
+		frame_indexes[idx] = iter->first;
+		controls[idx] = &val;
+		pointers[idx] = val.ptr<uint8_t>();
+		all_continuous = all_continuous and val.isContinuous() and val.type() == thumbnail.type() and val.size() == thumbnail.size();
+	}
+
+	// when zones are used, only the included pixels count
+	const size_t number_of_bytes = thumbnail.total() * thumbnail.channels();
+	const size_t number_of_values = (use_zones ? zone_values : number_of_bytes);
+
+	const cv::Mat * movement_control = nullptr;
+	[[maybe_unused]] size_t controls_compared = number_of_controls;
+	if (use_grid == false)
+	{
+		grid_scores = cv::Mat();
+	}
+
+	if (number_of_controls > 0 and all_continuous and use_grid)
+	{
+		const int columns				= std::clamp(grid_size.width, 1, thumbnail.cols);
+		const int rows					= std::clamp(grid_size.height, 1, thumbnail.rows);
+		const size_t number_of_cells	= columns * rows;
+		const int channels				= thumbnail.channels();
+
+		// the number of values in each cell must use the same boundaries as Kernels::sse_u8_grid()
+		cv::AutoBuffer<size_t> cell_values(number_of_cells);
+		for (int row = 0; row < rows; row ++)
+		{
+			for (int column = 0; column < columns; column ++)
+			{
+				const int x1 = column * thumbnail.cols / columns;
+				const int x2 = (column + 1) * thumbnail.cols / columns;
+				const int y1 = row * thumbnail.rows / rows;
+				const int y2 = (row + 1) * thumbnail.rows / rows;
+				const cv::Rect rect(x1, y1, x2 - x1, y2 - y1);
+				cell_values[row * columns + column] = (use_zones ? cv::countNonZero(zones(rect).reshape(1)) : rect.area() * channels);
+			}
+		}
+
+		grid_scores.create(rows, columns, CV_64FC1);
+		grid_scores.setTo(std::numeric_limits<double>::infinity());
+		double * scores = grid_scores.ptr<double>();
+
+		cv::AutoBuffer<uint64_t> cells(number_of_cells);
+		for (idx = 0; idx < number_of_controls; idx ++)
+		{
+			Kernels::sse_u8_grid(thumbnail.ptr<uint8_t>(), pointers[idx], use_zones ? zones.ptr<uint8_t>() : nullptr, thumbnail.cols, thumbnail.rows, channels, columns, rows, cells.data());
+
+			uint64_t total = 0;
+			bool cell_movement = false;
+			for (size_t cell = 0; cell < number_of_cells; cell ++)
+			{
+				total += cells[cell];
+
+				// unlike the overall PSNR, a cell without any differences must not be reported as movement
+				if (cells[cell] > 0)
+				{
+					const double score = Kernels::psnr_from_sse(cells[cell], cell_values[cell]);
+					scores[cell] = std::min(scores[cell], score);
+					cell_movement = cell_movement or score < grid_psnr_threshold;
+				}
+			}
+
+			most_recent_psnr_score = Kernels::psnr_from_sse(total, number_of_values);
+			if (cell_movement or most_recent_psnr_score < threshold)
+			{
+				movement_control = controls[idx];
+				controls_compared = idx + 1;
+				MOVEDETECT_COUNT(statistics.early_exits += (controls_compared < number_of_controls ? 1 : 0));
+				break;
+			}
+		}
+	}
+	else if (number_of_controls > 0 and all_continuous)
+	{
+		// Compare against all control frames in a single pass over the new thumbnail, and stop as soon as we know at
+		// least one of the controls is below the PSNR threshold.
+		const uint64_t limit = Kernels::sse_limit_from_psnr(threshold, number_of_values);
+		if (shared_comparisons and use_zones == false)
+		{
+			// Other handlers may have already compared this thumbnail against the same control frames.  Every
+			// comparison is done in full so it can be re-used, and the most recent control above the limit is used.
+			for (idx = 0; idx < number_of_controls; idx ++)
+			{
+				auto iter = std::find_if(shared_comparisons->begin(), shared_comparisons->end(),
+					[&](const auto & comparison) { return comparison.first == frame_indexes[idx]; });
+				if (iter == shared_comparisons->end())
+				{
+					shared_comparisons->emplace_back(frame_indexes[idx], Kernels::sse_u8(thumbnail.ptr<uint8_t>(), pointers[idx], number_of_bytes));
+					iter = shared_comparisons->end() - 1;
+				}
+				else
+				{
+					MOVEDETECT_COUNT(statistics.comparisons_reused ++);
+				}
+
+				// same as the original loop, an identical control (PSNR of zero) also counts as movement
+				results[idx] = iter->second;
+				if (results[idx] > limit or results[idx] == 0)
+				{
+					break;
+				}
+			}
+		}
+		else
+		{
+			idx = Kernels::sse_u8_one_to_many(thumbnail.ptr<uint8_t>(), pointers.data(), number_of_controls, number_of_bytes, limit, results.data(), use_zones ? zones.ptr<uint8_t>() : nullptr);
+		}
+
+		// Identical images also count as movement (PSNR of zero), and a more recent identical control must be used
+		// instead of an older control which went above the limit, same as the original loop.  The results up to idx
+		// are always complete.
+		idx = std::find(results.data(), results.data() + idx, 0) - results.data();
+		MOVEDETECT_COUNT(statistics.early_exits += (idx + 1 < number_of_controls ? 1 : 0));
+
+		if (idx < number_of_controls)
+		{
+			most_recent_psnr_score = Kernels::psnr_from_sse(results[idx], number_of_values);
+			movement_control = controls[idx];
+		}
+		else
+		{
+			// same as the original loop which ended on the oldest control frame
+			most_recent_psnr_score = Kernels::psnr_from_sse(results[number_of_controls - 1], number_of_values);
+		}
+	}
+	else
+	{
+		for (idx = 0; idx < number_of_controls; idx ++)
+		{
+			most_recent_psnr_score = psnr(*controls[idx], thumbnail);
+			if (most_recent_psnr_score < threshold)
+			{
+				movement_control = controls[idx];
+				controls_compared = idx + 1;
+				MOVEDETECT_COUNT(statistics.early_exits += (controls_compared < number_of_controls ? 1 : 0));
+				break;
+			}
+		}
+	}
+
+	MOVEDETECT_COUNT(statistics.last_control_frames_compared = controls_compared);
+	MOVEDETECT_COUNT(statistics.control_frames_compared += controls_compared);
+
+	return movement_control;
+}
+
+
+const cv::Mat * MoveDetect::Handler::compare_running_average(const cv::Mat & thumbnail)
+{
+	if (thumbnail.depth() != CV_8U or thumbnail.isContinuous() == false)
+	{
+		throw std::invalid_argument("the running average requires 8-bit images");
+	}
+
+	// grid mode is only supported with the control frames
+	grid_scores = cv::Mat();
+
+	const int float_type = CV_MAKETYPE(CV_32F, thumbnail.channels());
+	if (background_mean.size() != thumbnail.size() or background_mean.type() != float_type)
+	{
+		// This is the first thumbnail, or the size has changed.  Same as when there are no control frames, there is
+		// nothing to compare against yet.
+		thumbnail.convertTo(background_mean, float_type);
+		background_variance = cv::Mat();
+		MOVEDETECT_COUNT(statistics.image_reallocations ++);
+		MOVEDETECT_COUNT(statistics.last_control_frames_compared = 0);
+
+		return nullptr;
+	}
+
+	if (running_average_variance_enabled and background_variance.size() != background_mean.size())
+	{
+		background_variance = cv::Mat::zeros(background_mean.size(), float_type);
+		MOVEDETECT_COUNT(statistics.image_reallocations ++);
+	}
+	else if (running_average_variance_enabled == false)
+	{
+		background_variance = cv::Mat();
+	}
+
+	const bool use_zones = (zone_mask.empty() == false);
+	const size_t number_of_bytes = thumbnail.total() * thumbnail.channels();
+	const size_t number_of_values = (use_zones ? zone_mask_values : number_of_bytes);
+
+	// The 8-bit background is needed to create the differences when there is movement, and it must be the average
+	// from before it is updated with this thumbnail, so the kernel writes it out during the same pass.
+	background.create(thumbnail.size(), thumbnail.type());
+
+	const double sse = Kernels::sse_running_average(
+		thumbnail.ptr<uint8_t>(),
+		background_mean.ptr<float>(),
+		background_variance.empty() ? nullptr : background_variance.ptr<float>(),
+		use_zones ? zone_mask.ptr<uint8_t>() : nullptr,
+		background.ptr<uint8_t>(),
+		number_of_bytes,
+		static_cast<float>(std::clamp(running_average_alpha, 0.0, 1.0)),
+		static_cast<float>(running_average_noise_factor));
+
+	MOVEDETECT_COUNT(statistics.last_control_frames_compared = 1);
+	MOVEDETECT_COUNT(statistics.control_frames_compared ++);
+
+	if (number_of_values == 0)
+	{
+		// everything has been excluded so there is nothing to compare
+		most_recent_psnr_score = 0.0;
+		return nullptr;
+	}
+
+	// The average converges on a static scene, so unlike identical control frames a difference of zero is not treated
+	// as movement.  Rounding up to 1 gives the highest PSNR possible for this many values instead.
+	most_recent_psnr_score = Kernels::psnr_from_sse(std::max<uint64_t>(1, std::llround(sse)), number_of_values);
+	if (most_recent_psnr_score >= psnr_threshold)
+	{
+		return nullptr;
+	}
+
+	return &background;
+}
+
+
+MoveDetect::Handler & MoveDetect::Handler::add_region_of_interest(const Polygon & polygon)
+{
+	if (polygon.size() < 3)
+	{
+		throw std::invalid_argument("a region of interest needs at least 3 points");
+	}
+
+	regions_of_interest.push_back(polygon);
+	zone_mask_is_valid = false;
+
+	return *this;
+}
+
+
+MoveDetect::Handler & MoveDetect::Handler::add_exclusion_zone(const Polygon & polygon)
+{
+	if (polygon.size() < 3)
+	{
+		throw std::invalid_argument("an exclusion zone needs at least 3 points");
+	}
+
+	exclusion_zones.push_back(polygon);
+	zone_mask_is_valid = false;
+
+	return *this;
+}
+
+
+MoveDetect::Handler & MoveDetect::Handler::clear_zones()
+{
+	regions_of_interest.clear();
+	exclusion_zones.clear();
+	zone_mask				= cv::Mat();
+	zone_mask_values		= 0;
+	zone_mask_is_valid		= false;
+	coarse_zone_mask		= cv::Mat();
+	coarse_zone_mask_values	= 0;
+
+	return *this;
+}
+
+
+void MoveDetect::Handler::update_zone_mask(const cv::Size & image_size, const int type)
+{
+	if (regions_of_interest.empty() and exclusion_zones.empty())
+	{
+		zone_mask			= cv::Mat();
+		coarse_zone_mask	= cv::Mat();
+		return;
+	}
+
+	const cv::Size coarse_size = (cascade_enabled ? cascade_size() : cv::Size(0, 0));
+
+	if (zone_mask_is_valid and
+		zone_mask_image_size == image_size and
+		zone_mask.size() == thumbnail_size and
+		zone_mask.type() == type and
+		coarse_zone_mask.size() == coarse_size)
+	{
+		// nothing has changed since the last time the zones were rasterized
+		return;
+	}
+
+	if (CV_MAT_DEPTH(type) != CV_8U)
+	{
+		throw std::invalid_argument("regions of interest and exclusion zones require 8-bit images");
+	}
+
+	rasterize_zones(image_size, thumbnail_size, type, zone_mask, zone_mask_values);
+	MOVEDETECT_COUNT(statistics.image_reallocations ++);
+
+	coarse_zone_mask		= cv::Mat();
+	coarse_zone_mask_values	= 0;
+	if (coarse_size.area() > 0)
+	{
+		rasterize_zones(image_size, coarse_size, type, coarse_zone_mask, coarse_zone_mask_values);
+		MOVEDETECT_COUNT(statistics.image_reallocations ++);
+	}
+
+	zone_mask_image_size	= image_size;
+	zone_mask_is_valid		= true;
+
+	return;
+}
+
+
+void MoveDetect::Handler::rasterize_zones(const cv::Size & image_size, const cv::Size & size, const int type, cv::Mat & zones, size_t & values) const
+{
+	// The polygons are scaled to thumbnail coordinates using 4 bits of sub-pixel precision.  The integer coordinates
+	// used by cv::fillPoly() are at the centre of each pixel, hence the half pixel offset.
+	const int shift			= 4;
+	const double scale_x	= static_cast<double>(size.width) / static_cast<double>(image_size.width);
+	const double scale_y	= static_cast<double>(size.height) / static_cast<double>(image_size.height);
+	auto to_thumbnail = [&](const std::vector<Polygon> & polygons)
+	{
+		std::vector<Polygon> scaled;
+		for (const auto & polygon : polygons)
+		{
+			Polygon points;
+			for (const auto & point : polygon)
+			{
+				points.emplace_back(
+					std::lround((point.x * scale_x - 0.5) * (1 << shift)),
+					std::lround((point.y * scale_y - 0.5) * (1 << shift)));
+			}
+			scaled.push_back(points);
+		}
+		return scaled;
+	};
+
+	cv::Mat weights(size, CV_8UC1, cv::Scalar(regions_of_interest.empty() ? 255 : 0));
+	if (regions_of_interest.empty() == false)
+	{
+		cv::fillPoly(weights, to_thumbnail(regions_of_interest), cv::Scalar(255), cv::LINE_8, shift);
+	}
+	if (exclusion_zones.empty() == false)
+	{
+		cv::fillPoly(weights, to_thumbnail(exclusion_zones), cv::Scalar(0), cv::LINE_8, shift);
+	}
+
+	// expand the mask so there is one byte for every byte in the thumbnail, which is what the SSE kernels expect
+	const int channels = CV_MAT_CN(type);
+	if (channels == 1)
+	{
+		zones = weights;
+	}
+	else
+	{
+		std::vector<cv::Mat> planes(channels, weights);
+		cv::merge(planes, zones);
+	}
+
+	values = cv::countNonZero(weights) * channels;
+
+	return;
+}
+
+
+cv::Size MoveDetect::Handler::cascade_size() const
+{
+	const double ratio = std::clamp(cascade_ratio, 0.01, 1.0);
+
+	return cv::Size(
+		std::max(1, static_cast<int>(std::lround(thumbnail_size.width * ratio))),
+		std::max(1, static_cast<int>(std::lround(thumbnail_size.height * ratio))));
+}
+
+
+void MoveDetect::Handler::update_adaptive_interval(const size_t frame_index)
+{
+	if (adaptive_enabled == false)
+	{
+		adaptive_interval	= 1;
+		adaptive_reason		= AdaptiveReason::Disabled;
+	}
+	else
+	{
+		const auto time_since_movement = std::chrono::high_resolution_clock::now() - movement_last_detected;
+
+		if (movement_detected or time_since_movement < adaptive_stable_time)
+		{
+			adaptive_reason = AdaptiveReason::RecentMovement;
+		}
+		else if (most_recent_psnr_score < psnr_threshold + adaptive_psnr_margin)
+		{
+			adaptive_reason = AdaptiveReason::NearThreshold;
+		}
+		else if (adaptive_previous_psnr - most_recent_psnr_score > adaptive_psnr_margin)
+		{
+			adaptive_reason = AdaptiveReason::PsnrDropping;
+		}
+		else
+		{
+			adaptive_reason = AdaptiveReason::Stable;
+		}
+
+		if (adaptive_reason == AdaptiveReason::Stable)
+		{
+			// back off gradually, doubling the interval every time the scene is confirmed to be stable
+			adaptive_interval = std::clamp<size_t>(adaptive_interval * 2, 1, std::max<size_t>(1, adaptive_maximum_interval));
+		}
+		else
+		{
+			// snap back to looking at every frame
+			adaptive_interval = 1;
+		}
+	}
+
+	adaptive_previous_psnr	= most_recent_psnr_score;
+	adaptive_next_frame		= frame_index + adaptive_interval;
+
+	return;
+}
+
+
+cv::Mat MoveDetect::Handler::create_mask(const cv::Mat & differences, const cv::Size & size) const
+{
+	if (mask_low_resolution)
+	{
+		// the only full-size operation is this final resize of the binary mask
+		cv::Mat resized;
+		cv::resize(create_thumbnail_mask(to_greyscale(differences), size), resized, size, 0, 0, cv::INTER_NEAREST);
+
+		return resized;
+	}
+
+	// This gives us a very tiny 3-channel image.
+	// Now resize it to match the original image size.
+
+	cv::Mat differences_resized;
+	cv::resize(differences, differences_resized, size, 0, 0, cv::INTER_CUBIC);
+
+	// We'd like to generate a binary threshold, but that requires us to convert
+	// the image to greyscale first.
+	cv::Mat threshold;
+	cv::threshold(to_greyscale(differences_resized), threshold, 0.0, 255.0, cv::THRESH_BINARY | cv::THRESH_OTSU);
+
+	// And finally we dilate + erode the results to combine regions.
+	return close_mask(threshold, morphology_iterations);
+}
+
+
+cv::Mat MoveDetect::Handler::create_thumbnail_mask(const cv::Mat & greyscale, const cv::Size & size) const
+{
+	// Do all the work on the tiny thumbnail-sized image.  The number of dilate/erode iterations is scaled down by the
+	// same amount as the thumbnail so the regions are combined the same way as they are at full resolution.
+	const double scale		= static_cast<double>(greyscale.cols) / static_cast<double>(size.width);
+	const int iterations	= (morphology_iterations <= 0 ? 0 : std::max(1, static_cast<int>(std::round(morphology_iterations * scale))));
+
+	cv::Mat threshold;
+	cv::threshold(greyscale, threshold, 0.0, 255.0, cv::THRESH_BINARY | cv::THRESH_OTSU);
+
+	return close_mask(threshold, iterations);
+}
+
+
+cv::Mat MoveDetect::Handler::close_mask(const cv::Mat & binary, const int iterations) const
+{
+	if (iterations <= 0 or morphology_size <= 1)
+	{
+		return binary;
+	}
+
+	if (morphology_shape == cv::MORPH_RECT and morphology_size % 2 == 1 and binary.type() == CV_8UC1)
+	{
+		// Several iterations of a square kernel is the same as a single larger square kernel, which we can apply in
+		// a constant number of passes regardless of how large it is.
+		const size_t radius = static_cast<size_t>(iterations) * (morphology_size - 1) / 2;
+
+		cv::Mat dilated(binary.size(), CV_8UC1);
+		Kernels::dilate_rect_u8(binary.ptr<uint8_t>(), binary.step[0], dilated.ptr<uint8_t>(), dilated.step[0], binary.cols, binary.rows, radius);
+		cv::Mat eroded(binary.size(), CV_8UC1);
+		Kernels::erode_rect_u8(dilated.ptr<uint8_t>(), dilated.step[0], eroded.ptr<uint8_t>(), eroded.step[0], binary.cols, binary.rows, radius);
+
+		return eroded;
+	}
+
+	const cv::Mat kernel = cv::getStructuringElement(morphology_shape, cv::Size(morphology_size, morphology_size));
+	cv::Mat dilated;
+	cv::dilate(binary, dilated, kernel, cv::Point(-1, -1), iterations);
+	cv::Mat eroded;
+	cv::erode(dilated, eroded, kernel, cv::Point(-1, -1), iterations);
+
+	return eroded;
+}
+
+
+const cv::Mat & MoveDetect::Handler::get_mask()
+{
+	if (mask_is_valid == false and last_image.empty() == false)
+	{
+		MOVEDETECT_TIME_STAGE(Mask);
+		MOVEDETECT_COUNT(statistics.image_reallocations ++);
+
+		if (movement_detected)
+		{
+			mask			= create_mask(differences, last_image.size());
+			mask_is_blank	= false;
+		}
+		else
+		{
+			// no movement so the mask is a "blank" image
+			mask			= cv::Mat(last_image.size(), CV_8UC1, {0, 0, 0});
+			mask_is_blank	= true;
+		}
+		mask_is_valid = true;
+	}
+
+	return mask;
+}
+
+
+const MoveDetect::Handler::Contours & MoveDetect::Handler::get_contours()
+{
+	if (contours_are_valid == false and last_image.empty() == false)
+	{
+		contours.clear();
+
+		// the contours of a blank mask are always empty
+		const cv::Mat & m = get_mask();
+		if (mask_is_blank == false)
+		{
+			MOVEDETECT_TIME_STAGE(Contours);
+			std::vector<cv::Vec4i> hierarchy;
+			cv::findContours(m, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+		}
+		contours_are_valid = true;
+	}
+
+	return contours;
+}
+
+
+cv::Rect MoveDetect::Handler::get_bounding_box()
+{
+	if (bbox_is_valid == false and last_image.empty() == false)
+	{
+		const cv::Mat & m = get_mask();
+		MOVEDETECT_TIME_STAGE(BoundingBox);
+		bbox = mask_is_blank ? cv::Rect() : cv::boundingRect(m);
+		bbox_is_valid = true;
+	}
+
+	return bbox;
+}
+
+
+const cv::Mat & MoveDetect::Handler::get_output()
+{
+	if (output_is_valid == false and last_image.empty() == false)
+	{
+		// make sure the mask is created first so it isn't included in the time it takes to draw the output
+		if (contours_enabled)
+		{
+			get_contours();
+		}
+		if (bbox_enabled)
+		{
+			get_bounding_box();
+		}
+
+		MOVEDETECT_TIME_STAGE(Output);
+		MOVEDETECT_COUNT(statistics.image_reallocations ++);
+
+		if (last_image.channels() == 1)
+		{
+			// greyscale images are converted so the contours and bounding box can be drawn in colour
+			cv::Mat bgr;
+			cv::cvtColor(last_image, bgr, cv::COLOR_GRAY2BGR);
+			output = bgr;
+		}
+		else
+		{
+			output = last_image.clone();
+		}
+
+		if (contours_enabled)
+		{
+			for (auto & contour : get_contours())
+			{
+				cv::polylines(output, contour, true, {0, 0, 255}, contours_size, line_type);
+			}
+		}
+
+		if (bbox_enabled)
+		{
+			cv::rectangle(output, get_bounding_box(), {0, 255, 255}, bbox_size, line_type);
+		}
+
+		output_is_valid = true;
+	}
+
+	return output;
+}
+
+
+const MoveDetect::MotionRegions & MoveDetect::Handler::get_regions()
+{
+	if (regions_are_valid == false and last_image.empty() == false)
+	{
+		regions.clear();
+
+		if (movement_detected)
+		{
+			MOVEDETECT_TIME_STAGE(Regions);
+
+			// everything is done at thumbnail resolution, and only the results are scaled back to the original image size
+			const cv::Mat greyscale		= to_greyscale(differences);
+			const cv::Mat binary		= create_thumbnail_mask(greyscale, last_image.size());
+			const double scale_x		= static_cast<double>(last_image.cols) / static_cast<double>(binary.cols);
+			const double scale_y		= static_cast<double>(last_image.rows) / static_cast<double>(binary.rows);
+			const cv::Rect image_rect(0, 0, last_image.cols, last_image.rows);
+
+			cv::Mat labels;
+			cv::Mat stats;
+			cv::Mat centroids;
+			const int number_of_labels = cv::connectedComponentsWithStats(binary, labels, stats, centroids, 8, CV_32S);
+
+			// the score is the average difference within each region, so we need to sum the differences for each label
+			std::vector<double> total_difference(number_of_labels, 0.0);
+			for (int y = 0; y < labels.rows; y ++)
+			{
+				const int * label = labels.ptr<int>(y);
+				const uint8_t * difference = greyscale.ptr<uint8_t>(y);
+				for (int x = 0; x < labels.cols; x ++)
+				{
+					total_difference[label[x]] += difference[x];
+				}
+			}
+
+			// label #0 is the background
+			for (int label = 1; label < number_of_labels; label ++)
+			{
+				const int area = stats.at<int>(label, cv::CC_STAT_AREA);
+
+				MotionRegion region;
+				region.area		= static_cast<size_t>(std::round(area * scale_x * scale_y));
+				if (region.area < region_minimum_area)
+				{
+					continue;
+				}
+
+				// each thumbnail pixel covers a block of "scale" pixels in the original image
+				const int x1	= std::floor(stats.at<int>(label, cv::CC_STAT_LEFT) * scale_x);
+				const int y1	= std::floor(stats.at<int>(label, cv::CC_STAT_TOP) * scale_y);
+				const int x2	= std::ceil((stats.at<int>(label, cv::CC_STAT_LEFT) + stats.at<int>(label, cv::CC_STAT_WIDTH)) * scale_x);
+				const int y2	= std::ceil((stats.at<int>(label, cv::CC_STAT_TOP) + stats.at<int>(label, cv::CC_STAT_HEIGHT)) * scale_y);
+				region.rect		= cv::Rect(x1, y1, x2 - x1, y2 - y1) & image_rect;
+				region.centroid	= cv::Point2d(
+					(centroids.at<double>(label, 0) + 0.5) * scale_x,
+					(centroids.at<double>(label, 1) + 0.5) * scale_y);
+				region.score	= total_difference[label] / (255.0 * area);
+
+				regions.push_back(region);
+			}
+
+			// the largest regions are the most interesting ones
+			std::sort(regions.begin(), regions.end(),
+				[](const MotionRegion & lhs, const MotionRegion & rhs)
+				{
+					return lhs.area > rhs.area;
+				});
+		}
+
+		regions_are_valid = true;
+	}
+
+	return regions;
+}
+
+
+MoveDetect::Statistics MoveDetect::Handler::snapshot(const bool reset)
+{
+	const Statistics copy = statistics;
+	if (reset)
+	{
+		statistics.reset();
+	}
+
+	return copy;
 }
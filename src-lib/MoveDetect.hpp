@@ -5,8 +5,10 @@
 #pragma once
 
 #include <chrono>
-#include <map>
+#include <cstdint>
 #include <opencv2/opencv.hpp>
+#include "ControlMap.hpp"
+#include "Statistics.hpp"
 
 
 namespace MoveDetect
@@ -21,7 +23,14 @@ namespace MoveDetect
 	double psnr(const cv::Mat & src, const cv::Mat & dst);
 
 
-	/** Simple colour balancing.
+	/** Sum of squared differences between two 8-bit images of the same size and type.  This is computed in a single
+	 * pass over both images with integer accumulators, and without allocating any temporary images.  @see @ref psnr()
+	 */
+	uint64_t sse(const cv::Mat & src, const cv::Mat & dst);
+
+
+	/** Simple colour balancing.  This is the same as calling @ref simple_colour_balance_lut() followed by the other
+	 * @ref simple_colour_balance() which applies the lookup table.
 	 *
 	 * @li Source:  https://stackoverflow.com/a/49481583/13022
 	 * @li Source:  http://web.stanford.edu/~sujason/ColorBalancing/simplestcb.html
@@ -29,11 +38,137 @@ namespace MoveDetect
 	 */
 	cv::Mat simple_colour_balance(const cv::Mat & src);
 
+	/** Apply a colour balancing lookup table previously created with @ref simple_colour_balance_lut().  This is a single
+	 * pass over the image, so the same lookup table can be re-used for several frames of a video where the exposure
+	 * does not change quickly.
+	 */
+	cv::Mat simple_colour_balance(const cv::Mat & src, const cv::Mat & lut);
+
+	/** Create the lookup table used for simple colour balancing.  A 256-bin histogram is built for each channel in a
+	 * single pass over the image, and the low and high 0.5% of the values are saturated, while the rest are scaled to
+	 * use the full 0-255 range.  The image must be 8-bit, with either 1 or 3 channels.
+	 *
+	 * @return A 1x256 lookup table with the same number of channels as @p src, suitable for use with @p cv::LUT().
+	 */
+	cv::Mat simple_colour_balance_lut(const cv::Mat & src);
+
 
-	/** We keep several control thumbnail images to compare against.  This typedef defines the map that tracks these
-	 * thumbnails.  The key is the frame index, the value is the thumbnail itself.
+	/** The results of calling @ref Handler::detect() on a single frame.  This is used when frames are processed
+	 * asynchronously, such as with @ref DetectorPool, where the @ref Handler cannot be queried directly.
 	 */
-	typedef std::map<size_t, cv::Mat> ControlMap;
+	struct Result
+	{
+		/// The stream to which this frame belongs.  This is only used by @ref DetectorPool.
+		size_t stream_id = 0;
+
+		/// The frame index that was assigned to this frame.
+		size_t frame_index = 0;
+
+		/// @see @ref Handler::movement_detected
+		bool movement_detected = false;
+
+		/// @see @ref Handler::transition_detected
+		bool transition_detected = false;
+
+		/// @see @ref Handler::most_recent_psnr_score
+		double psnr_score = 0.0;
+
+		/// @see @ref Handler::mask
+		cv::Mat mask;
+
+		/// @see @ref Handler::output
+		cv::Mat output;
+	};
+
+	/** Pixel formats which can be passed directly to @ref Handler::detect() without first being converted to BGR.
+	 * For all of the YUV formats, only the luma (Y) plane is used, which is always the first plane in the buffer.
+	 */
+	enum class PixelFormat
+	{
+		BGR,	///< Interleaved 8-bit blue, green, red.  This is the usual format of a @p cv::Mat.
+		Grey,	///< Single 8-bit channel.
+		NV12,	///< Y plane followed by interleaved UV plane.  Typical output of hardware video decoders.
+		NV21,	///< Y plane followed by interleaved VU plane.
+		I420,	///< Y plane followed by separate U and V planes.  Also known as YUV420p.
+		YV12	///< Y plane followed by separate V and U planes.
+	};
+
+	/** The reason why @ref Handler::detect() is analyzing every frame or skipping frames.
+	 * @see @ref Handler::adaptive_enabled
+	 */
+	enum class AdaptiveReason
+	{
+		Disabled,		///< Adaptive mode is disabled, so every frame is analyzed.
+		RecentMovement,	///< Movement was detected within @ref Handler::adaptive_stable_time, so every frame is analyzed.
+		NearThreshold,	///< The PSNR is within @ref Handler::adaptive_psnr_margin of the threshold, so every frame is analyzed.
+		PsnrDropping,	///< The PSNR dropped by more than @ref Handler::adaptive_psnr_margin, so every frame is analyzed.
+		Stable			///< The scene is stable, so frames are being skipped.  @see @ref Handler::adaptive_interval
+	};
+
+	/** The different ways the thumbnails can be created.  @see @ref Handler::thumbnail_method
+	 */
+	enum class ThumbnailMethod
+	{
+		OpenCV,		///< Use @p cv::resize() with @p cv::INTER_AREA.  This is the original method.
+		Integer,	///< Average blocks of pixels using integer sums, in parallel bands of rows.  Only used with 8-bit images.
+		IntegerFast	///< Same as @ref ThumbnailMethod::Integer, but only every Nth row is used.  @see @ref Handler::thumbnail_row_step
+	};
+
+	/** The different ways @ref Handler::detect() can decide whether a frame has movement.  @see @ref Handler::engine
+	 */
+	enum class Engine
+	{
+		ControlFrames,	///< Compare against each of the key frames stored in @ref Handler::control.  This is the original method.
+		RunningAverage	///< Compare against a single running average of all the previous thumbnails.
+	};
+
+	/** Describes one area of the image where movement was detected.  @see @ref Handler::get_regions()
+	 */
+	struct MotionRegion
+	{
+		/// Bounding rectangle of the region, in original image coordinates.
+		cv::Rect rect;
+
+		/// Approximate number of pixels in the region, in original image coordinates.
+		size_t area = 0;
+
+		/// Centre of mass of the region, in original image coordinates.
+		cv::Point2d centroid;
+
+		/** Average difference between the frame and the control thumbnail within this region, where @p 0.0 means no
+		 * difference and @p 1.0 means the largest possible difference.
+		 */
+		double score = 0.0;
+	};
+
+	/// Multiple regions where movement was detected.  @see @ref Handler::get_regions()
+	typedef std::vector<MotionRegion> MotionRegions;
+
+	/** A span of consecutive frames where movement was detected.  @see @ref Handler::detect_intervals()
+	 */
+	struct MotionInterval
+	{
+		/// The first frame with movement.
+		size_t start_frame = 0;
+
+		/// The last frame with movement.  This is inclusive, so an interval with a single frame has the same start and end.
+		size_t end_frame = 0;
+
+		/// The lowest PSNR seen within the interval.  @see @ref Handler::most_recent_psnr_score
+		double min_psnr = 0.0;
+
+		/// The highest PSNR seen within the interval, which is usually the frame with the least movement.
+		double max_psnr = 0.0;
+
+		/// The frame where @ref min_psnr was seen, which is usually the frame with the most movement.
+		size_t peak_frame = 0;
+	};
+
+	/// Multiple intervals where movement was detected.  @see @ref Handler::detect_intervals()
+	typedef std::vector<MotionInterval> MotionIntervals;
+
+	class IntervalTracker;
+	class MultiHandler;
 
 	/** This class is used to store some image thumbnails, configuration settings, and also contains the @ref detect()
 	 * method which is used to determine if a video frame has movement.  @see @ref Summary
@@ -62,7 +197,7 @@ namespace MoveDetect
 			 *
 			 * @return @p true if movement is detected, otherwise returns @p false.
 			 *
-			 * @warning This method adds and removes image thumbnails from a @p std::map, so it must not be called simultaneously
+			 * @warning This method adds and removes image thumbnails from @ref control, so it must not be called simultaneously
 			 * from multiple threads.
 			 *
 			 * @see @ref movement_detected
@@ -80,9 +215,10 @@ namespace MoveDetect
 			bool detect(cv::Mat & next_image);
 
 			/** Detect whether there is any movement in an arbritrary image frame.
-			 * The frame index must be greater than or equal to @ref next_frame_index.
+			 * The frame index must be greater than or equal to @ref next_frame_index.  The image may be either 3-channel
+			 * BGR or 1-channel greyscale.
 			 *
-			 * @warning This method adds and removes image thumbnails from a @p std::map, so it must not be called simultaneously
+			 * @warning This method adds and removes image thumbnails from @ref control, so it must not be called simultaneously
 			 * from multiple threads.
 			 *
 			 * @return @p true if movement is detected, otherwise returns @p false.
@@ -92,6 +228,141 @@ namespace MoveDetect
 			 */
 			bool detect(const size_t frame_index, cv::Mat & image);
 
+			/** Detect whether there is any movement in an image, using a thumbnail which has already been created by
+			 * @ref create_thumbnail().  This is the same as the other @ref detect() with a frame index, except the colour
+			 * balancing and resizing are skipped.  This allows the thumbnails to be created ahead of time, or on other
+			 * threads, while the comparisons are done in order.  The thumbnail must be the same type as @p image, and
+			 * the same size as @ref thumbnail_size if it has already been set.
+			 *
+			 * @see @ref AsyncHandler
+			 */
+			bool detect(const size_t frame_index, cv::Mat & image, const cv::Mat & thumbnail);
+
+			/** Create a thumbnail of @p image the same way @ref detect() would, for use with the @ref detect() which
+			 * takes a thumbnail.  This does not modify the handler, so it may be called from other threads as long as the
+			 * configuration is not being modified at the same time.
+			 *
+			 * @param [in] image The full-size image.
+			 * @param [in] lut Optional colour balancing lookup table to apply before resizing.  Since this method does not
+			 * modify the handler, @ref colour_balance_enabled is ignored and the caller must provide the table.
+			 * @see @ref simple_colour_balance_lut()
+			 */
+			cv::Mat create_thumbnail(const cv::Mat & image, const cv::Mat & lut = cv::Mat()) const;
+
+			/** Detect movement over many frames at once, such as when indexing recorded video.  The thumbnails are created
+			 * in parallel using all the cores, and then compared in order, the same as calling @ref detect() on each frame.
+			 * The mask and output are not created for any of the frames, regardless of @ref mask_enabled.
+			 *
+			 * The frames are given the indexes @ref next_frame_index, @ref next_frame_index + 1, etc.
+			 *
+			 * @return The spans of consecutive frames where movement was detected.  If the last frame has movement, then the
+			 * last interval ends on that frame.
+			 */
+			MotionIntervals detect_intervals(const std::vector<cv::Mat> & frames);
+
+			/** Same as the other @ref detect_intervals(), but the frames are read from @p video.  Only a small number of
+			 * frames are decoded and kept in memory at any one time, so this can be used with videos of any length.
+			 *
+			 * @param [in] video The video to read.  It must already be opened.
+			 * @param [in] first_frame The index of the first frame to read.  If this is not zero, then the video is
+			 * positioned using @p cv::CAP_PROP_POS_FRAMES.  This must be greater than or equal to @ref next_frame_index.
+			 * @param [in] last_frame The index of the last frame to read, inclusive.  Reading also stops at the end of the
+			 * video.
+			 */
+			MotionIntervals detect_intervals(cv::VideoCapture & video, const size_t first_frame = 0, const size_t last_frame = SIZE_MAX);
+
+			/** Detect whether there is any movement in a raw image buffer, such as the output of a hardware video decoder.
+			 * The buffer is not copied or converted.  For YUV formats, only the luma plane is used, and it is resized
+			 * directly into a greyscale thumbnail, which also makes the comparisons 3 times cheaper than BGR thumbnails.
+			 *
+			 * @param [in] frame_index The frame index, same as the other @ref detect().
+			 * @param [in] format The layout of the data in @p data.
+			 * @param [in] data Pointer to the first byte of the image.  For YUV formats, this is the start of the Y plane.
+			 * @param [in] width Width of the image in pixels.
+			 * @param [in] height Height of the image in pixels.  For YUV formats, this is the height of the Y plane.
+			 * @param [in] stride Number of bytes between the start of each row.  Use @p 0 if the rows are not padded.
+			 *
+			 * @warning If @ref lazy_evaluation is enabled, the buffer must remain valid and unmodified until the output and
+			 * mask are no longer needed, since they are created from this buffer.
+			 *
+			 * @return @p true if movement is detected, otherwise returns @p false.
+			 */
+			bool detect(const size_t frame_index, const PixelFormat format, const uint8_t * data, const int width, const int height, const size_t stride = 0);
+
+			/// Same as the other @ref detect() with a raw buffer, but uses @ref next_frame_index as the frame index.
+			bool detect(const PixelFormat format, const uint8_t * data, const int width, const int height, const size_t stride = 0);
+
+			/// Each contour is a list of points.  @see @ref get_contours()
+			typedef std::vector<std::vector<cv::Point>> Contours;
+
+			/** Get the binary @ref mask for the most recent call to @ref detect().  The mask is only created the first time
+			 * it is requested for each frame.  This works even if @ref mask_enabled has not been set.
+			 */
+			const cv::Mat & get_mask();
+
+			/** Dilate and then erode a binary image @p iterations times using @ref morphology_shape and
+			 * @ref morphology_size, which is how nearby regions of movement are combined in the @ref mask.  The result is
+			 * the same as calling @p cv::dilate() and then @p cv::erode() with the same number of iterations.
+			 */
+			cv::Mat close_mask(const cv::Mat & binary, const int iterations) const;
+
+			/** Get the external contours of the @ref mask for the most recent call to @ref detect().  The contours are only
+			 * found the first time they are requested for each frame.
+			 */
+			const Contours & get_contours();
+
+			/** Get the bounding box around all the movement in the @ref mask for the most recent call to @ref detect().  The
+			 * bounding box is only calculated the first time it is requested for each frame.  When no movement was detected
+			 * an empty rectangle is returned.
+			 */
+			cv::Rect get_bounding_box();
+
+			/** Get the individual regions where movement was detected for the most recent call to @ref detect(), sorted
+			 * from largest to smallest.  Unlike @ref get_bounding_box() which returns a single rectangle around all the
+			 * movement, this uses connected components to separate the different moving objects.  The work is done at
+			 * thumbnail resolution, and the results are scaled back to original image coordinates.  The regions are only
+			 * calculated the first time they are requested for each frame.
+			 *
+			 * @see @ref region_minimum_area
+			 */
+			const MotionRegions & get_regions();
+
+			/** Get the @ref output image for the most recent call to @ref detect(), with contours and bounding box drawn
+			 * according to @ref contours_enabled and @ref bbox_enabled.  The output image is only created the first time it
+			 * is requested for each frame.
+			 *
+			 * @warning The output is created from the image that was passed to @ref detect().  If @ref lazy_evaluation is
+			 * enabled, then that image must not be modified until after this has been called.
+			 */
+			const cv::Mat & get_output();
+
+			/** Each zone is a polygon in original image coordinates.  @see @ref add_region_of_interest()
+			 * @see @ref add_exclusion_zone()
+			 */
+			typedef std::vector<cv::Point> Polygon;
+
+			/** Only look for movement within this polygon.  The polygon is in original image coordinates.  Multiple
+			 * regions of interest may be added, in which case movement is detected within any of them.  When no regions of
+			 * interest have been added, the entire image is used.
+			 *
+			 * The polygons are rasterized once at thumbnail resolution, and the result is cached until the zones or the
+			 * image size change.  Pixels which are excluded do not contribute to the PSNR, nor do they show up in the
+			 * @ref mask.  This only applies to 8-bit images.
+			 *
+			 * @see @ref add_exclusion_zone()
+			 * @see @ref clear_zones()
+			 */
+			Handler & add_region_of_interest(const Polygon & polygon);
+
+			/** Ignore any movement within this polygon, such as trees blowing in the wind, a clock, or the edge of a busy
+			 * road.  The polygon is in original image coordinates.  Exclusion zones take precedence over regions of
+			 * interest.  @see @ref add_region_of_interest()
+			 */
+			Handler & add_exclusion_zone(const Polygon & polygon);
+
+			/// Remove all regions of interest and exclusion zones so the entire image is used again.
+			Handler & clear_zones();
+
 			/// This is the same as the value returne by @ref detect() and indicates whether the last image seen showed movement.
 			bool movement_detected;
 
@@ -100,6 +371,98 @@ namespace MoveDetect
 			 */
 			bool transition_detected;
 
+			/** Set to @p true to colour balance each frame before the thumbnail is created.  This helps with cameras where
+			 * the exposure drifts over time.  The colour balancing lookup table is only re-calculated every
+			 * @ref colour_balance_frequency frames.  Default value is @p false.  @see @ref simple_colour_balance()
+			 */
+			bool colour_balance_enabled;
+
+			/** When @ref colour_balance_enabled is set, this is how often the colour balancing lookup table is calculated.
+			 * Default value is @p 30, which for videos recorded at 30 FPS means once per second.
+			 */
+			size_t colour_balance_frequency;
+
+			/** Set to @p true to record timings and counters into @ref statistics.  When disabled, the only cost is a single
+			 * boolean check per stage.  The timing code can also be removed entirely at compile time by defining
+			 * @p MOVEDETECT_INSTRUMENTATION to @p 0.  Default value is @p false.
+			 */
+			bool instrumentation_enabled;
+
+			/** Timings and counters recorded when @ref instrumentation_enabled is set.  The timings for the lazy stages such as
+			 * the mask and output are recorded whenever they are created.  @see @ref snapshot()
+			 */
+			Statistics statistics;
+
+			/** Get a copy of @ref statistics.  If @p reset is @p true, the statistics are also reset to zero, which is useful
+			 * when the values are periodically exported to a metrics system and each snapshot should cover a new interval.
+			 */
+			Statistics snapshot(const bool reset = false);
+
+			/** Save the configuration, the frame indexes, and the control thumbnails, so detection can resume from the same
+			 * point in another process.  The thumbnails are stored as raw pixels aligned on 64-byte boundaries, so there
+			 * is no encoding step and the saved data may be memory-mapped and passed directly to @ref load().
+			 *
+			 * The format is versioned, and uses the byte order of the computer where it was saved.  Statistics, the mask,
+			 * the output, and the colour balancing lookup table are not saved.
+			 */
+			void save(std::ostream & stream) const;
+
+			/// Save to a file.  @see @ref save()
+			void save(const std::string & filename) const;
+
+			/// Save to a block of memory.  @see @ref save()
+			std::vector<uint8_t> save() const;
+
+			/** Restore a handler previously saved with @ref save().  All the existing settings and thumbnails are replaced.
+			 * Since @ref movement_detected is also restored, the first frame after loading does not report a transition
+			 * unless the movement state really changes.
+			 *
+			 * @throw std::invalid_argument if the data is not a valid snapshot, or was saved with an unsupported version.
+			 */
+			Handler & load(const uint8_t * data, const size_t size);
+
+			/// Load from a stream.  @see @ref load()
+			Handler & load(std::istream & stream);
+
+			/// Load from a file.  @see @ref load()
+			Handler & load(const std::string & filename);
+
+			/** Set to @p true to allow @ref detect() to skip frames when the scene has been stable for a while.  Each time a
+			 * frame is analyzed and the scene is found to be stable, the interval between analyzed frames is doubled, up to
+			 * @ref adaptive_maximum_interval.  As soon as movement is detected or the PSNR starts to drop, the interval goes
+			 * back to @p 1 so every frame is analyzed.  Skipped frames are reported with @ref frame_skipped, and the reason
+			 * for the current rate is in @ref adaptive_reason.  Default value is @p false.
+			 */
+			bool adaptive_enabled;
+
+			/** When @ref adaptive_enabled is set, this is the largest number of frames between analyzed frames.
+			 * Default value is @p 8, meaning that at most 7 frames in a row will be skipped.
+			 */
+			size_t adaptive_maximum_interval;
+
+			/** When @ref adaptive_enabled is set, the scene must not have had any movement for this amount of time before
+			 * frames are skipped.  @see @ref movement_last_detected.  Default value is @p 5 seconds.
+			 */
+			std::chrono::high_resolution_clock::duration adaptive_stable_time;
+
+			/** When @ref adaptive_enabled is set, frames are only skipped if the PSNR is at least this much above
+			 * @ref psnr_threshold, and has not dropped by more than this much since the previous analyzed frame.
+			 * Default value is @p 3.0.
+			 */
+			double adaptive_psnr_margin;
+
+			/// The current number of frames between analyzed frames.  @see @ref adaptive_enabled
+			size_t adaptive_interval;
+
+			/// The reason for the current @ref adaptive_interval.  @see @ref adaptive_enabled
+			AdaptiveReason adaptive_reason;
+
+			/** Set to @p true when the most recent call to @ref detect() skipped the frame because the scene is stable.
+			 * When a frame is skipped, @ref movement_detected is not modified, @ref transition_detected is @p false, and the
+			 * mask and output still refer to the last frame analyzed.  @see @ref adaptive_enabled
+			 */
+			bool frame_skipped;
+
 			/// The index of the next frame expected to be seen by @ref detect().
 			size_t next_frame_index;
 
@@ -127,9 +490,65 @@ namespace MoveDetect
 			 */
 			double psnr_threshold;
 
-			/// The PSNR value received from the most recent call to @ref detect().  @see @ref psnr()
+			/** The PSNR value received from the most recent call to @ref detect().  When @ref cascade_enabled is set and the
+			 * small thumbnails made the decision, this is their PSNR minus @ref cascade_psnr_offset, which is an estimate of
+			 * what the full-size thumbnails would have scored.  @see @ref psnr()
+			 */
 			double most_recent_psnr_score;
 
+			/** Determines what each new thumbnail is compared against.  The default @ref Engine::ControlFrames compares
+			 * against up to @ref number_of_control_frames key frames, so the work done for each frame grows with the length
+			 * of the history.  @ref Engine::RunningAverage instead keeps a single exponentially weighted average of all
+			 * previous thumbnails, so each frame is compared once regardless of how much history is kept.  In that mode,
+			 * @ref key_frame_frequency, @ref number_of_control_frames, and @ref grid_enabled are not used.  Every frame is
+			 * treated as a key frame, so @ref control only holds the most recent thumbnail, and
+			 * @ref Statistics::key_frames_inserted counts every frame.  Default value is @ref Engine::ControlFrames.
+			 *
+			 * @see @ref running_average_alpha
+			 * @see @ref running_average_variance_enabled
+			 */
+			Engine engine;
+
+			/** When @ref engine is set to @ref Engine::RunningAverage, this is the weight given to each new thumbnail.
+			 * Smaller values remember the scene for longer.  For example, @p 0.05 means roughly the last 20 frames have an
+			 * influence on the average.  Default value is @p 0.05.
+			 */
+			double running_average_alpha;
+
+			/** When @ref engine is set to @ref Engine::RunningAverage, set this to @p true to also keep a running variance
+			 * for every value in the thumbnail.  Differences within @ref running_average_noise_factor standard deviations
+			 * are then ignored, so parts of the image which are always changing such as leaves or water do not trigger
+			 * movement.  Default value is @p false.
+			 */
+			bool running_average_variance_enabled;
+
+			/// The number of standard deviations ignored when @ref running_average_variance_enabled is set.  Default value is @p 2.0.
+			double running_average_noise_factor;
+
+			/** Set to @p true to also split the thumbnail into a grid of cells, and calculate the PSNR of each cell.  A small
+			 * change in one corner of the image is diluted when the PSNR is calculated over the entire thumbnail, but is
+			 * easily noticed when only looking at the cells around it.  Movement is detected when either the PSNR of the
+			 * entire thumbnail is below @ref psnr_threshold, or when the PSNR of any cell is below
+			 * @ref grid_psnr_threshold.  The cell scores are calculated in the same pass over the thumbnail as the
+			 * overall PSNR.  Default value is @p false.  @see @ref grid_scores
+			 */
+			bool grid_enabled;
+
+			/** The number of cells across (width) and down (height) when @ref grid_enabled is set.  This is clamped to the
+			 * size of the thumbnail.  Default value is @p 4x4.
+			 */
+			cv::Size grid_size;
+
+			/// The threshold value for each cell when @ref grid_enabled is set.  Default value is @p 32.0.
+			double grid_psnr_threshold;
+
+			/** When @ref grid_enabled is set, this is the PSNR of each cell from the most recent call to @ref detect().  The
+			 * matrix has one row for each row of cells, and is of type @p CV_64FC1.  The value is the lowest PSNR for that
+			 * cell across all the control frames that were compared.  Cells without any differences, or where every pixel
+			 * has been excluded, are set to infinity.  When @ref grid_enabled is not set, this is empty.
+			 */
+			cv::Mat grid_scores;
+
 			/** How much the image will be reduced to generate the thumbnails.  The larger the thumbnail, the more precise the
 			 * detection, but the more processing needs to be done for every frame.  And if it is made too large, the library
 			 * will pick up image artifacts or subtle tiny changes and think that movement was detected.
@@ -140,14 +559,66 @@ namespace MoveDetect
 			/// The size of the thumbnail that will be generated.  Instead of modifying this value, see @ref thumbnail_ratio.
 			cv::Size thumbnail_size;
 
+			/** How the thumbnails are created.  When set to @ref ThumbnailMethod::Integer, each pixel in the thumbnail is
+			 * the rounded average of a block of pixels, calculated using integer sums.  Each row of the original image is
+			 * read once, and several bands of rows are processed in parallel.  The results are exactly the same on every
+			 * platform and with any number of threads.  This is usually much faster than @p cv::resize().  When the image
+			 * is an exact multiple of the thumbnail size, the pixel values may occasionally differ by @p 1 from
+			 * @ref ThumbnailMethod::OpenCV.  Otherwise each block is a whole number of pixels instead of a fractional area,
+			 * so the values may differ by more where the image has fine detail.  Images which are not 8-bit always use
+			 * @p cv::resize().  Default value is @ref ThumbnailMethod::OpenCV.
+			 */
+			ThumbnailMethod thumbnail_method;
+
+			/** When @ref thumbnail_method is set to @ref ThumbnailMethod::IntegerFast, only every Nth row of the original
+			 * image is used to create the thumbnail.  Default value is @p 2.
+			 */
+			size_t thumbnail_row_step;
+
+			/** Set to @p true to first compare each frame using a second, much smaller set of thumbnails.  Frames where the
+			 * PSNR of the small thumbnails is clearly above or clearly below @ref psnr_threshold plus
+			 * @ref cascade_psnr_offset are decided without ever creating the full-size thumbnail.  Only the frames which fall
+			 * within @ref cascade_band of that threshold, and the key frames which need to be stored in @ref control, use
+			 * @ref thumbnail_size.  When movement is decided using the small thumbnails, the mask, contours, and regions are
+			 * also created from the small thumbnails, and @ref most_recent_psnr_score is the PSNR of the small thumbnails
+			 * minus @ref cascade_psnr_offset so it can still be compared against @ref psnr_threshold.
+			 * This is only used with @ref Engine::ControlFrames, and is ignored when @ref grid_enabled is set or when
+			 * @ref detect() is given a thumbnail.  Default value is @p false.
+			 *
+			 * @see @ref Statistics::coarse_decisions
+			 */
+			bool cascade_enabled;
+
+			/** The size of the small thumbnails used when @ref cascade_enabled is set, relative to @ref thumbnail_size.
+			 * Default value is @p 0.25, meaning 1/16th the number of pixels.
+			 */
+			double cascade_ratio;
+
+			/** How close to the threshold for the small thumbnails the PSNR of the small thumbnails must be before the
+			 * full-size thumbnails are also compared.  For example, with the default values the full-size thumbnails are
+			 * compared when the small thumbnails have a PSNR between @p 34.0 and @p 42.0.  Default value is @p 4.0.
+			 * @see @ref cascade_psnr_offset
+			 */
+			double cascade_band;
+
+			/** How much higher the threshold is for the small thumbnails than @ref psnr_threshold.  Averaging blocks of
+			 * pixels can never lower the PSNR, so the small thumbnails always score the same or higher than the full-size
+			 * thumbnails.  How much higher depends on the scene:  a moving object much larger than a block barely changes,
+			 * while noise which is different for every pixel gains up to @p 10*log10(1/cascade_ratio^2) dB, which is
+			 * @p 12 dB with the default @ref cascade_ratio.  The default value of @p 6.0 is halfway between the two.  Use a
+			 * larger value if small or faint movement is being missed when @ref cascade_enabled is set.
+			 */
+			double cascade_psnr_offset;
+
 			/// The most recent frame index where movement was detected.  @see @ref movement_last_detected
 			size_t frame_index_with_movement;
 
 			/// The timestamp when @ref detect() last returned @p true.
 			std::chrono::high_resolution_clock::time_point movement_last_detected;
 
-			/** All of the key control thumbnail images are stored in this map.  When calling @ref detect(), the images are
-			 * compared against the thumbnails stored within.
+			/** All of the key control thumbnail images are stored in this ring buffer.  When calling @ref detect(), the images
+			 * are compared against the thumbnails stored within.  The ring buffer is sized using @ref number_of_control_frames,
+			 * and new thumbnails are resized directly into it, so once it is full no more memory needs to be allocated.
 			 */
 			ControlMap control;
 
@@ -156,7 +627,8 @@ namespace MoveDetect
 			 */
 			bool mask_enabled;
 
-			/** When @ref mask_enabled is enabled, the result is saved to @p mask.  This is a binary 1-channel image,
+			/** When @ref mask_enabled is enabled, the result is saved to @p mask.  When @ref lazy_evaluation is enabled, the
+			 * mask is only saved here once @ref get_mask() is called.  This is a binary 1-channel image,
 			 * OpenCV type @p CV_8UC1, where @p 0 is the background and @p 1 is where movement is detected.
 			 *
 			 * Given this video frame of someone walking across a parking lot:
@@ -170,6 +642,41 @@ namespace MoveDetect
 			 */
 			cv::Mat mask;
 
+			/** When set to @p true, @ref detect() only determines whether there was movement.  The @ref mask and @ref output
+			 * are no longer created for every frame, and are instead only created when requested by calling @ref get_mask(),
+			 * @ref get_contours(), @ref get_bounding_box(), or @ref get_output().  This makes the cost of @ref detect() the
+			 * same regardless of @ref mask_enabled, @ref contours_enabled, and @ref bbox_enabled.  Default value is @p false.
+			 */
+			bool lazy_evaluation;
+
+			/** When set to @p true, the greyscale conversion, threshold, and dilate/erode used to create the @ref mask are
+			 * all done at the size of the thumbnail, and only the final binary mask is resized to the original image size.
+			 * The number of dilate/erode iterations is scaled by the same ratio as the thumbnail.  This is many times
+			 * faster than the default, at the cost of blockier mask edges.  Default value is @p false.
+			 * @see @ref mask_enabled
+			 */
+			bool mask_low_resolution;
+
+			/** The shape of the kernel used to dilate and then erode the @ref mask, which combines nearby regions of
+			 * movement.  When this is @p cv::MORPH_RECT and @ref morphology_size is odd, the iterations are combined into a
+			 * single large square kernel, and the time it takes does not depend on the size of the kernel.  Other shapes
+			 * use @p cv::dilate() and @p cv::erode().  Default value is @p cv::MORPH_RECT.
+			 */
+			cv::MorphShapes morphology_shape;
+
+			/// The width and height of the kernel.  @see @ref morphology_shape.  Default value is @p 3.
+			int morphology_size;
+
+			/** The number of times the mask is dilated, and then eroded.  When @ref mask_low_resolution is set, this is
+			 * scaled down by the same ratio as the thumbnail.  Use @p 0 to disable.  Default value is @p 10.
+			 */
+			int morphology_iterations;
+
+			/** Regions smaller than this many pixels (in original image coordinates) are ignored by @ref get_regions().
+			 * Default value is @p 0, meaning all regions are returned.
+			 */
+			size_t region_minimum_area;
+
 			/** The type of line type drawing OpenCV will use if @ref contours_enabled or @ref bbox_enabled have been set.
 			 * Set this to @p cv::LINE_AA to get prettier anti-alised lines.  Default is @p cv::LINE_4.
 			 */
@@ -214,6 +721,7 @@ namespace MoveDetect
 			int bbox_size;
 
 			/** When either @ref contours_enabled or @ref bbox_enabled is enabled, the resulting image is stored in @p output.
+			 * When @ref lazy_evaluation is enabled, the output is only saved here once @ref get_output() is called.
 			 *
 			 * Given this video frame of someone walking across a parking lot:
 			 *
@@ -225,5 +733,142 @@ namespace MoveDetect
 			 * @image html movement_with_contour_and_bbox.png
 			 */
 			cv::Mat output;
+
+		private:
+
+			friend class MultiHandler;
+
+			/// Implementation of @ref detect().  When @p precomputed_thumbnail is @p nullptr, the thumbnail is created from @p image.
+			bool process(const size_t frame_index, cv::Mat & image, const cv::Mat * precomputed_thumbnail);
+
+			/** Used by @ref detect_intervals() to process a group of frames:  create all the thumbnails in parallel, then
+			 * call @ref detect() on each frame in order and give the results to @p tracker.  The intervals which end within
+			 * this group of frames are added to @p intervals.  The caller must add the last interval once all the groups have
+			 * been processed.  @see @ref IntervalTracker::finish()
+			 */
+			void detect_batch(const size_t first_frame_index, const std::vector<cv::Mat> & frames, IntervalTracker & tracker, MotionIntervals & intervals);
+
+			/// Create the binary @ref mask from the differences between the two thumbnails.  @see @ref mask_low_resolution
+			cv::Mat create_mask(const cv::Mat & differences, const cv::Size & size) const;
+
+			/** Compare the new thumbnail against all the control thumbnails in @p control_map and set
+			 * @ref most_recent_psnr_score.  The zones must be the same size as the thumbnail, or empty.  Movement is
+			 * detected when the PSNR is below @p threshold.  The grid is only used when @p use_grid is set.
+			 * @return The control thumbnail where movement was detected, or @p nullptr if there is no movement.
+			 */
+			const cv::Mat * compare(const ControlMap & control_map, const cv::Mat & thumbnail, const cv::Mat & zones, const size_t zone_values, const double threshold, const bool use_grid);
+
+			/** Compare the new thumbnail against the running average, update the running average, and set
+			 * @ref most_recent_psnr_score.  @see @ref Engine::RunningAverage
+			 * @return The running average as an 8-bit image if movement was detected, or @p nullptr if there is no movement.
+			 */
+			const cv::Mat * compare_running_average(const cv::Mat & thumbnail);
+
+			/// Decide how many frames can be skipped after this one.  @see @ref adaptive_enabled
+			void update_adaptive_interval(const size_t frame_index);
+
+			/** Rasterize the regions of interest and exclusion zones into @ref zone_mask if they have changed, or if the
+			 * size of the image or thumbnail has changed.
+			 */
+			void update_zone_mask(const cv::Size & image_size, const int type);
+
+			/// Rasterize the regions of interest and exclusion zones into a mask of the given size and type.
+			void rasterize_zones(const cv::Size & image_size, const cv::Size & size, const int type, cv::Mat & zones, size_t & values) const;
+
+			/// The size of the small thumbnails.  @see @ref cascade_ratio
+			cv::Size cascade_size() const;
+
+			/// Threshold and combine the regions of a thumbnail-sized greyscale difference image.
+			cv::Mat create_thumbnail_mask(const cv::Mat & greyscale, const cv::Size & size) const;
+
+			/// The image passed to the most recent call to @ref detect().  This is not a copy.
+			cv::Mat last_image;
+
+			/// Thumbnail-sized differences between the new thumbnail and the control where movement was detected.
+			cv::Mat differences;
+
+			/// @see @ref get_contours()
+			Contours contours;
+
+			/// @see @ref get_bounding_box()
+			cv::Rect bbox;
+
+			/// @see @ref get_regions()
+			MotionRegions regions;
+
+			/// @see @ref colour_balance_enabled
+			cv::Mat colour_balance_lut;
+
+			/// The next frame index where @ref colour_balance_lut needs to be calculated again.
+			size_t colour_balance_next_frame;
+
+			/// The colour balanced frame.  This is re-used for every frame to avoid allocating a new image.
+			cv::Mat colour_balanced;
+
+			/// The next frame index which will be analyzed.  @see @ref adaptive_enabled
+			size_t adaptive_next_frame;
+
+			/// The PSNR of the previous frame analyzed.  @see @ref adaptive_psnr_margin
+			double adaptive_previous_psnr;
+
+			/// Running average of the thumbnails, with one float per byte.  @see @ref Engine::RunningAverage
+			cv::Mat background_mean;
+
+			/// @see @ref running_average_variance_enabled
+			cv::Mat background_variance;
+
+			/// The 8-bit version of @ref background_mean from before the most recent thumbnail was added.
+			cv::Mat background;
+
+			/// @see @ref add_region_of_interest()
+			std::vector<Polygon> regions_of_interest;
+
+			/// @see @ref add_exclusion_zone()
+			std::vector<Polygon> exclusion_zones;
+
+			/** Thumbnail-sized mask with the same type as the thumbnails, where every byte is either @p 0x00 (excluded) or
+			 * @p 0xFF (included).  This is empty when there are no zones, meaning the entire image is used.
+			 */
+			cv::Mat zone_mask;
+
+			/// The number of bytes set to @p 0xFF in @ref zone_mask.
+			size_t zone_mask_values;
+
+			/// The size of the image used to create @ref zone_mask.
+			cv::Size zone_mask_image_size;
+
+			/// Set to @p false when the zones are modified and @ref zone_mask needs to be rasterized again.
+			bool zone_mask_is_valid;
+
+			/** The small thumbnails used when @ref cascade_enabled is set.  A key frame is always added to both this and
+			 * @ref control, so the two hold the same frame indexes once they are both full.
+			 */
+			ControlMap coarse_control;
+
+			/// Same as @ref zone_mask, but the size of the thumbnails in @ref coarse_control.
+			cv::Mat coarse_zone_mask;
+
+			/// The number of bytes set to @p 0xFF in @ref coarse_zone_mask.
+			size_t coarse_zone_mask_values;
+
+			/// The frame index of a control thumbnail, and the sum of squared differences between it and the new thumbnail.
+			typedef std::vector<std::pair<size_t, uint64_t>> SharedComparisons;
+
+			/** Set by @ref MultiHandler while a frame is being processed.  All the handlers store the same thumbnails, so
+			 * the comparison against each control frame is only done by the first handler which needs it.
+			 */
+			SharedComparisons * shared_comparisons;
+
+			/// Set by @ref MultiHandler so key frames refer to the shared thumbnail instead of a copy.  @see @ref ControlMap::share()
+			bool share_thumbnails;
+
+			/// Remember when the mask is blank so it does not need to be created again for every frame without movement.
+			bool mask_is_blank;
+
+			bool mask_is_valid;
+			bool contours_are_valid;
+			bool bbox_is_valid;
+			bool output_is_valid;
+			bool regions_are_valid;
 	};
 }
@@ -0,0 +1,116 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "MultiHandler.hpp"
+
+
+MoveDetect::MultiHandler::MultiHandler() :
+	next_frame_index(0),
+	colour_balance_next_frame(0)
+{
+	return;
+}
+
+
+MoveDetect::MultiHandler::~MultiHandler()
+{
+	return;
+}
+
+
+MoveDetect::Handler & MoveDetect::MultiHandler::thumbnails()
+{
+	return producer;
+}
+
+
+size_t MoveDetect::MultiHandler::add()
+{
+	return add(Handler());
+}
+
+
+size_t MoveDetect::MultiHandler::add(const Handler & configuration)
+{
+	handlers.push_back(configuration);
+
+	// Only the settings are kept.  Control frames from another stream would not match the shared thumbnails, and the
+	// comparisons are shared using the frame index of the control frames.
+	Handler & handler = handlers.back();
+	handler.control.clear();
+	handler.next_key_frame = 0;
+
+	return handlers.size() - 1;
+}
+
+
+MoveDetect::Handler & MoveDetect::MultiHandler::handler(const size_t idx)
+{
+	if (idx >= handlers.size())
+	{
+		throw std::out_of_range("invalid handler index " + std::to_string(idx));
+	}
+
+	return handlers[idx];
+}
+
+
+bool MoveDetect::MultiHandler::detect(cv::Mat & image)
+{
+	return detect(next_frame_index, image);
+}
+
+
+bool MoveDetect::MultiHandler::detect(const size_t frame_index, cv::Mat & image)
+{
+	if (image.empty())
+	{
+		throw std::invalid_argument("cannot detect using an empty image");
+	}
+
+	// same colour balancing rules as Handler::detect(), but only done once for all the handlers
+	cv::Mat lut;
+	if (producer.colour_balance_enabled and (image.depth() == CV_8U and (image.channels() == 1 or image.channels() == 3)))
+	{
+		if (colour_balance_lut.empty() or colour_balance_lut.channels() != image.channels() or frame_index >= colour_balance_next_frame)
+		{
+			colour_balance_lut			= simple_colour_balance_lut(image);
+			colour_balance_next_frame	= frame_index + std::max<size_t>(1, producer.colour_balance_frequency);
+		}
+		lut = colour_balance_lut;
+	}
+
+	// A new thumbnail is needed for every frame, since the previous one may still be used as a control by some handlers.
+	most_recent_thumbnail = producer.create_thumbnail(image, lut);
+	comparisons.clear();
+
+	bool movement_detected = false;
+	for (auto & handler : handlers)
+	{
+		handler.thumbnail_size		= most_recent_thumbnail.size();
+		handler.shared_comparisons	= &comparisons;
+		handler.share_thumbnails	= true;
+
+		try
+		{
+			handler.detect(frame_index, image, most_recent_thumbnail);
+		}
+		catch (...)
+		{
+			handler.shared_comparisons	= nullptr;
+			handler.share_thumbnails	= false;
+			throw;
+		}
+
+		// the handler must not keep a pointer to our comparisons in case it is copied
+		handler.shared_comparisons	= nullptr;
+		handler.share_thumbnails	= false;
+
+		movement_detected = movement_detected or handler.movement_detected;
+	}
+
+	next_frame_index = frame_index + 1;
+
+	return movement_detected;
+}
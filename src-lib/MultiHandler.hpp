@@ -0,0 +1,116 @@
+// MoveDetect -- Library to detect whether movement can be detected between two images or video frames.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <deque>
+#include "MoveDetect.hpp"
+
+
+namespace MoveDetect
+{
+	/** Run several @ref Handler configurations against the same video stream, while only doing the work that depends
+	 * on the pixels once.
+	 *
+	 * For example, one handler may be used for alerts, another for recording, and a third for analytics, each with a
+	 * different @ref Handler::psnr_threshold, @ref Handler::key_frame_frequency, or
+	 * @ref Handler::number_of_control_frames.  Instead of each handler creating its own thumbnail and keeping its own
+	 * copy of the control thumbnails:
+	 *
+	 * @li The colour balancing and the thumbnail are done once for each frame, using the settings in @ref thumbnails().
+	 * @li The control thumbnails are stored once.  Every handler which keeps a frame as a key frame refers to the same
+	 * reference-counted thumbnail, which is released once no handler needs it.  @see @ref ControlMap::share()
+	 * @li The new thumbnail is compared once against each distinct control frame, and the sum of squared differences
+	 * is re-used by every other handler which has the same control frame.  @see @ref Statistics::comparisons_reused
+	 *
+	 * Each handler still decides on its own whether there is movement, and still creates its own mask, contours, and
+	 * other output.
+	 *
+	 * ~~~~{.cpp}
+	 * MoveDetect::MultiHandler multi;
+	 * multi.thumbnails().thumbnail_ratio = 0.1;
+	 * const size_t alerts = multi.add();
+	 * const size_t analytics = multi.add();
+	 * multi.handler(alerts).psnr_threshold = 28.0;
+	 * multi.handler(analytics).number_of_control_frames = 10;
+	 *
+	 * while (video.read(frame))
+	 * {
+	 *     multi.detect(frame);
+	 *     if (multi.handler(alerts).transition_detected)
+	 *     {
+	 *         // ...
+	 *     }
+	 * }
+	 * ~~~~
+	 *
+	 * @note Regions of interest, exclusion zones, and @ref Handler::grid_enabled are supported, but a handler which uses
+	 * them does its own comparisons.  The thumbnail settings, colour balancing, and cascade settings of the individual
+	 * handlers are not used.
+	 */
+	class MultiHandler
+	{
+		public:
+
+			/// Constructor.
+			MultiHandler();
+
+			/// Destructor.
+			virtual ~MultiHandler();
+
+			/** The settings used to create the thumbnails for all the handlers.  Only @ref Handler::thumbnail_ratio,
+			 * @ref Handler::thumbnail_size, @ref Handler::thumbnail_method, @ref Handler::thumbnail_row_step,
+			 * @ref Handler::colour_balance_enabled, and @ref Handler::colour_balance_frequency are used.
+			 */
+			Handler & thumbnails();
+
+			/** Add a handler with default settings.
+			 * @return The index of the new handler.  @see @ref handler()
+			 */
+			size_t add();
+
+			/** Add a handler using @p configuration as the initial settings.
+			 * @return The index of the new handler.  @see @ref handler()
+			 */
+			size_t add(const Handler & configuration);
+
+			/// Access one of the handlers.  @throw std::out_of_range if the index is invalid.
+			Handler & handler(const size_t idx);
+
+			/// The number of handlers.
+			size_t size() const { return handlers.size(); }
+
+			/// Same as @ref Handler::detect(), but for all of the handlers.  @return @p true if any handler detected movement.
+			bool detect(cv::Mat & image);
+
+			/// Same as @ref Handler::detect(), but for all of the handlers.  @return @p true if any handler detected movement.
+			bool detect(const size_t frame_index, cv::Mat & image);
+
+			/// The thumbnail created for the most recent frame.  This is shared with the handlers and must not be modified.
+			const cv::Mat & thumbnail() const { return most_recent_thumbnail; }
+
+			/// The frame index which will be used by the next call to @ref detect().
+			size_t next_frame_index;
+
+		private:
+
+			/// @see @ref thumbnails()
+			Handler producer;
+
+			/// A deque is used so the references returned by @ref handler() remain valid when more handlers are added.
+			std::deque<Handler> handlers;
+
+			/// @see @ref thumbnail()
+			cv::Mat most_recent_thumbnail;
+
+			/// @see @ref Handler::colour_balance_enabled
+			cv::Mat colour_balance_lut;
+
+			/// The next frame index where @ref colour_balance_lut needs to be calculated again.
+			size_t colour_balance_next_frame;
+
+			/// The comparisons done for the current frame, which are shared by all the handlers.
+			Handler::SharedComparisons comparisons;
+	};
+}
@@ -0,0 +1,341 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "Recorder.hpp"
+
+
+MoveDetect::Recorder::Recorder(const size_t queue_size) :
+	pre_roll_frames(90),
+	pre_roll_maximum_bytes(32 * 1024 * 1024),
+	post_roll_frames(90),
+	jpeg_quality(80),
+	filename_prefix("movement_"),
+	filename_extension(".mp4"),
+	fourcc(cv::VideoWriter::fourcc('m', 'p', '4', 'v')),
+	fps(30.0),
+	pre_roll_size(0),
+	clip_is_open(false),
+	post_roll_remaining(0),
+	queue(std::max<size_t>(1, queue_size)),
+	clips_sent(0),
+	clips_closed(0)
+{
+	writer_thread = std::thread(&Recorder::run, this);
+
+	return;
+}
+
+
+MoveDetect::Recorder::~Recorder()
+{
+	try
+	{
+		finish();
+	}
+	catch (...)
+	{
+		// nothing we can do about writer exceptions at this point
+	}
+
+	queue.close();
+	writer_thread.join();
+
+	return;
+}
+
+
+MoveDetect::Recorder & MoveDetect::Recorder::add(const cv::Mat & frame, const Handler & handler)
+{
+	// detect() has already moved on to the next frame index
+	const size_t frame_index = (handler.next_frame_index > 0 ? handler.next_frame_index - 1 : 0);
+
+	return add(frame, frame_index, handler.movement_detected);
+}
+
+
+MoveDetect::Recorder & MoveDetect::Recorder::add(const cv::Mat & frame, const size_t frame_index, const bool movement_detected)
+{
+	if (frame.empty())
+	{
+		throw std::invalid_argument("cannot record an empty frame");
+	}
+
+	std::vector<uchar> jpeg;
+	append(jpeg, frame, frame_index, movement_detected);
+
+	return *this;
+}
+
+
+MoveDetect::Recorder & MoveDetect::Recorder::add(std::vector<uchar> jpeg, const size_t frame_index, const bool movement_detected)
+{
+	if (jpeg.empty())
+	{
+		throw std::invalid_argument("cannot record an empty JPEG");
+	}
+
+	append(jpeg, cv::Mat(), frame_index, movement_detected);
+
+	return *this;
+}
+
+
+MoveDetect::Recorder & MoveDetect::Recorder::finish()
+{
+	if (clip_is_open)
+	{
+		close_clip();
+	}
+
+	pre_roll.clear();
+	pre_roll_size = 0;
+
+	std::unique_lock<std::mutex> guard(finished_lock);
+	finished.wait(guard, [&]{ return clips_closed == clips_sent; });
+	guard.unlock();
+
+	rethrow();
+
+	return *this;
+}
+
+
+void MoveDetect::Recorder::append(std::vector<uchar> & jpeg, const cv::Mat & frame, const size_t frame_index, const bool movement_detected)
+{
+	rethrow();
+
+	if (clip_is_open and movement_detected == false and post_roll_remaining == 0)
+	{
+		// only happens when there is no post-roll
+		close_clip();
+	}
+
+	if (clip_is_open == false and movement_detected)
+	{
+		open_clip(frame_index);
+	}
+
+	std::unique_ptr<Packet> packet(new Packet);
+	packet->frame_index = frame_index;
+
+	if (clip_is_open)
+	{
+		// Frames in the clip are not compressed on this thread, the writer thread only needs its own copy of the pixels.
+		if (jpeg.empty())
+		{
+			packet->frame = frame.clone();
+		}
+		else
+		{
+			packet->jpeg.swap(jpeg);
+		}
+		queue.push(std::move(packet));
+
+		if (movement_detected)
+		{
+			post_roll_remaining = post_roll_frames;
+		}
+		else
+		{
+			post_roll_remaining --;
+			if (post_roll_remaining == 0)
+			{
+				close_clip();
+			}
+		}
+
+		return;
+	}
+
+	if (pre_roll_frames == 0)
+	{
+		return;
+	}
+
+	if (jpeg.empty())
+	{
+		cv::imencode(".jpg", frame, packet->jpeg, {cv::ImwriteFlags::IMWRITE_JPEG_QUALITY, std::clamp(jpeg_quality, 0, 100)});
+	}
+	else
+	{
+		packet->jpeg.swap(jpeg);
+	}
+
+	pre_roll_size += packet->jpeg.size();
+	pre_roll.push_back(std::move(packet));
+
+	// remove the oldest frames until we're back within both limits
+	while (pre_roll.empty() == false and (pre_roll.size() > pre_roll_frames or pre_roll_size > pre_roll_maximum_bytes))
+	{
+		pre_roll_size -= pre_roll.front()->jpeg.size();
+		pre_roll.pop_front();
+	}
+
+	return;
+}
+
+
+void MoveDetect::Recorder::open_clip(const size_t frame_index)
+{
+	const size_t first_frame = (pre_roll.empty() ? frame_index : pre_roll.front()->frame_index);
+
+	std::unique_ptr<Packet> packet(new Packet);
+	packet->frame_index	= first_frame;
+	packet->filename	= filename_prefix + std::to_string(first_frame) + filename_extension;
+	packet->fourcc		= fourcc;
+	packet->fps			= fps;
+
+	// The whole pre-roll is handed over in the same packet.  Pushing the frames one at a time would fill the queue and
+	// block the caller while the writer decodes and encodes them, right when movement starts.
+	packet->pre_roll.swap(pre_roll);
+	pre_roll_size = 0;
+
+	{
+		std::lock_guard<std::mutex> guard(finished_lock);
+		clips_sent ++;
+	}
+
+	queue.push(std::move(packet));
+
+	clip_is_open		= true;
+	post_roll_remaining	= post_roll_frames;
+
+	return;
+}
+
+
+void MoveDetect::Recorder::close_clip()
+{
+	std::unique_ptr<Packet> packet(new Packet);
+	packet->close = true;
+
+	queue.push(std::move(packet));
+
+	clip_is_open		= false;
+	post_roll_remaining	= 0;
+
+	return;
+}
+
+
+void MoveDetect::Recorder::rethrow()
+{
+	std::lock_guard<std::mutex> guard(finished_lock);
+	if (writer_exception)
+	{
+		std::exception_ptr ptr = writer_exception;
+		writer_exception = nullptr;
+		std::rethrow_exception(ptr);
+	}
+
+	return;
+}
+
+
+void MoveDetect::Recorder::run()
+{
+	cv::VideoWriter writer;
+	Clip clip;
+	int clip_fourcc		= 0;
+	double clip_fps		= 0.0;
+	bool clip_failed	= false;
+
+	auto write = [&](const Packet & frame_packet)
+	{
+		// frames from the pre-roll and from JPEG cameras are only decoded if they end up in a clip
+		cv::Mat frame = frame_packet.frame;
+		if (frame_packet.jpeg.empty() == false)
+		{
+			frame = cv::imdecode(frame_packet.jpeg, cv::ImreadModes::IMREAD_UNCHANGED);
+			if (frame.empty())
+			{
+				throw std::invalid_argument("failed to decode frame #" + std::to_string(frame_packet.frame_index));
+			}
+		}
+
+		if (writer.isOpened() == false)
+		{
+			writer.open(clip.filename, clip_fourcc, clip_fps, frame.size(), frame.channels() != 1);
+			if (writer.isOpened() == false)
+			{
+				throw std::invalid_argument("failed to open " + clip.filename);
+			}
+		}
+
+		writer.write(frame);
+		clip.last_frame = frame_packet.frame_index;
+		clip.number_of_frames ++;
+
+		return;
+	};
+
+	std::unique_ptr<Packet> packet;
+	while (queue.pop(packet))
+	{
+		try
+		{
+			if (packet->filename.empty() == false)
+			{
+				// the file is only created once we know the size of the first frame
+				clip				= Clip();
+				clip.filename		= packet->filename;
+				clip.first_frame	= packet->frame_index;
+				clip_fourcc			= packet->fourcc;
+				clip_fps			= packet->fps;
+				clip_failed			= false;
+
+				for (const auto & pre_roll_packet : packet->pre_roll)
+				{
+					write(*pre_roll_packet);
+				}
+			}
+			else if (packet->close)
+			{
+				writer.release();
+
+				// the clip must always be counted as closed, otherwise finish() would never return
+				std::exception_ptr exception;
+				if (clip_failed == false and clip.number_of_frames > 0 and clip_finished)
+				{
+					try
+					{
+						clip_finished(clip);
+					}
+					catch (...)
+					{
+						exception = std::current_exception();
+					}
+				}
+
+				{
+					std::lock_guard<std::mutex> guard(finished_lock);
+					clips_closed ++;
+					if (writer_exception == nullptr)
+					{
+						writer_exception = exception;
+					}
+				}
+				finished.notify_all();
+			}
+			else if (clip_failed == false)
+			{
+				write(*packet);
+			}
+		}
+		catch (...)
+		{
+			// skip the rest of this clip, but keep going so the next clip can still be recorded
+			clip_failed = true;
+			writer.release();
+
+			std::lock_guard<std::mutex> guard(finished_lock);
+			if (writer_exception == nullptr)
+			{
+				writer_exception = std::current_exception();
+			}
+		}
+	}
+
+	return;
+}
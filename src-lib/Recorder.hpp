@@ -0,0 +1,211 @@
+// MoveDetect -- Library to detect whether movement can be detected between two images or video frames.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "MoveDetect.hpp"
+#include "SpscQueue.hpp"
+
+
+namespace MoveDetect
+{
+	/** A video file written by @ref Recorder.  @see @ref Recorder::clip_finished
+	 */
+	struct Clip
+	{
+		/// The name of the video file.
+		std::string filename;
+
+		/// The first frame in the clip, which is usually the oldest frame in the pre-roll.
+		size_t first_frame = 0;
+
+		/// The last frame in the clip, which is the end of the post-roll.
+		size_t last_frame = 0;
+
+		/// The number of frames written to the clip.
+		size_t number_of_frames = 0;
+	};
+
+	/** Record only the parts of a video stream where movement was detected, along with a few seconds before and after.
+	 *
+	 * While there is no movement, each frame is compressed as a JPEG and kept in a small pre-roll ring buffer which is
+	 * limited both by the number of frames and by the number of bytes, so the memory used for each stream is bounded.
+	 * When movement starts, a new clip is opened, the pre-roll is written, and every following frame is written until
+	 * there has been no movement for @ref post_roll_frames.  The video encoding and the disk I/O are done by a background
+	 * thread, so the only work done on the caller's thread is the JPEG compression of frames without movement, and a
+	 * copy of the frames with movement.  The entire pre-roll is handed to the background thread at once, so the caller
+	 * is not blocked when movement starts.
+	 *
+	 * ~~~~{.cpp}
+	 * MoveDetect::Handler handler;
+	 * MoveDetect::Recorder recorder;
+	 * recorder.fps = video.get(cv::CAP_PROP_FPS);
+	 *
+	 * while (video.read(frame))
+	 * {
+	 *     handler.detect(frame);
+	 *     recorder.add(frame, handler);
+	 * }
+	 * recorder.finish();
+	 * ~~~~
+	 *
+	 * There should be one recorder for each video stream.
+	 */
+	class Recorder
+	{
+		public:
+
+			/// Callback used when a clip has been closed.  It is called on the thread which writes the clips.
+			typedef std::function<void(const Clip & clip)> Callback;
+
+			/** Constructor.  The writer thread is started immediately and remains running until the object is destroyed.
+			 *
+			 * @param [in] queue_size The maximum number of frames waiting to be written.  When the queue is full,
+			 * @ref add() blocks until there is room.
+			 */
+			Recorder(const size_t queue_size = 32);
+
+			/// Destructor.  This will close the current clip.
+			virtual ~Recorder();
+
+			/** Add the next frame.  The frame index and whether movement was detected are taken from @p handler, so this
+			 * must be called immediately after @ref Handler::detect().
+			 */
+			Recorder & add(const cv::Mat & frame, const Handler & handler);
+
+			/** Add the next frame.  The frame is either compressed or copied before this returns, so the caller can re-use
+			 * the pixels.
+			 *
+			 * @warning This must always be called from the same thread.
+			 */
+			Recorder & add(const cv::Mat & frame, const size_t frame_index, const bool movement_detected);
+
+			/** Add the next frame which has already been compressed as a JPEG, such as the frames from an MJPEG camera.
+			 * The frame is not compressed again when it is stored in the pre-roll, and is only decoded by the writer
+			 * thread if it ends up in a clip.
+			 *
+			 * @warning This must always be called from the same thread.
+			 */
+			Recorder & add(std::vector<uchar> jpeg, const size_t frame_index, const bool movement_detected);
+
+			/** Close the current clip, if any, and wait until everything has been written.  The pre-roll is discarded.
+			 * If an exception was thrown while writing the clips, the first such exception is rethrown.
+			 */
+			Recorder & finish();
+
+			/// Determine if a clip is currently being recorded.
+			bool recording() const { return clip_is_open; }
+
+			/// The number of bytes used by the frames in the pre-roll.
+			size_t pre_roll_bytes() const { return pre_roll_size; }
+
+			/// The number of frames in the pre-roll.
+			size_t pre_roll_length() const { return pre_roll.size(); }
+
+			/// The maximum number of frames kept before movement is detected.  Default value is @p 90.
+			size_t pre_roll_frames;
+
+			/** The maximum number of bytes used by the compressed frames in the pre-roll.  When this is exceeded, the
+			 * oldest frames are removed even if there are fewer than @ref pre_roll_frames.  Default value is @p 32 MiB.
+			 */
+			size_t pre_roll_maximum_bytes;
+
+			/// The number of frames without movement recorded before the clip is closed.  Default value is @p 90.
+			size_t post_roll_frames;
+
+			/// The quality used to compress the pre-roll frames, from @p 0 to @p 100.  Default value is @p 80.
+			int jpeg_quality;
+
+			/** Each clip is named using this prefix, followed by the first frame index, and @ref filename_extension.  The
+			 * prefix may include a directory.  Default value is @p "movement_".
+			 */
+			std::string filename_prefix;
+
+			/// Default value is @p ".mp4".  @see @ref filename_prefix
+			std::string filename_extension;
+
+			/// The codec used by @p cv::VideoWriter.  Default value is @p mp4v.
+			int fourcc;
+
+			/// The frame rate of the clips.  Default value is @p 30.0.
+			double fps;
+
+			/** Optional callback which is called once each clip has been closed.  This must be set before the first frame
+			 * is added.  An exception thrown by the callback is rethrown by the next call to @ref add() or @ref finish().
+			 */
+			Callback clip_finished;
+
+		private:
+
+			/// A single frame or command sent to the writer thread.
+			struct Packet
+			{
+				size_t frame_index = 0;
+
+				/// Either the JPEG or the frame is set, never both.
+				std::vector<uchar> jpeg;
+				cv::Mat frame;
+
+				/** When set, a new clip needs to be opened using this name before the frame is written.  The codec and frame
+				 * rate are copied so the writer thread never needs to read the configuration.
+				 */
+				std::string filename;
+				int fourcc = 0;
+				double fps = 0.0;
+
+				/// Sent with a new clip.  These frames are written as soon as the clip has been opened.
+				std::deque<std::unique_ptr<Packet>> pre_roll;
+
+				/// When set, the current clip needs to be closed.  There is no frame in this packet.
+				bool close = false;
+			};
+
+			/// Same as @ref add(), but with either a JPEG or an uncompressed frame.
+			void append(std::vector<uchar> & jpeg, const cv::Mat & frame, const size_t frame_index, const bool movement_detected);
+
+			/// Send the pre-roll to the writer thread as the start of a new clip, all in a single packet.
+			void open_clip(const size_t frame_index);
+
+			/// Tell the writer thread to close the current clip.
+			void close_clip();
+
+			/// The writer thread.
+			void run();
+
+			/// Rethrow the first exception from the writer thread.
+			void rethrow();
+
+			/// Frames kept before movement is detected.  These are always JPEG.
+			std::deque<std::unique_ptr<Packet>> pre_roll;
+
+			/// The number of bytes in @ref pre_roll.
+			size_t pre_roll_size;
+
+			bool clip_is_open;
+
+			/// The number of frames without movement which can still be written before the clip is closed.
+			size_t post_roll_remaining;
+
+			SpscQueue<std::unique_ptr<Packet>> queue;
+
+			std::thread writer_thread;
+
+			/// Used to wait for the writer thread to finish a clip.
+			std::mutex finished_lock;
+			std::condition_variable finished;
+			size_t clips_sent;
+			size_t clips_closed;
+
+			/// The first exception thrown by the writer thread.
+			std::exception_ptr writer_exception;
+	};
+}
@@ -0,0 +1,534 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "MoveDetect.hpp"
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <sstream>
+
+
+/* Layout of a snapshot.  All values use the byte order of the computer where the snapshot was saved, which is verified
+ * when loading using the byte order marker.  Pixel data always starts on a 64-byte boundary from the start of the
+ * snapshot, so a memory-mapped snapshot can be used without copying it first.
+ *
+ *		char[8]		magic "MDSNAP\0\0"
+ *		uint32		version
+ *		uint32		byte order marker 0x01020304
+ *		...			configuration settings, in the order they are written in Handler::save()
+ *		...			regions of interest and exclusion zones
+ *		uint64		next_frame_index, next_key_frame, etc.
+ *		int32		thumbnail type, rows, cols
+ *		uint64		number of control thumbnails, from oldest to newest, each one being:
+ *			uint64		frame index
+ *			padding		to a 64-byte boundary
+ *			uint8[]		raw pixels, rows * cols * element size
+ *		uint8		whether the running average is included, followed by the mean and variance if it is
+ */
+
+
+namespace
+{
+	const char snapshot_magic[8]		= {'M', 'D', 'S', 'N', 'A', 'P', '\0', '\0'};
+	const uint32_t snapshot_version		= 1;
+	const uint32_t snapshot_byte_order	= 0x01020304;
+	const size_t snapshot_alignment		= 64;
+
+	/// Write values to a stream, keeping track of the offset so the pixel data can be aligned.
+	class SnapshotWriter
+	{
+		public:
+
+			SnapshotWriter(std::ostream & s) :
+				stream(s),
+				offset(0)
+			{
+				return;
+			}
+
+			void bytes(const void * data, const size_t size)
+			{
+				stream.write(reinterpret_cast<const char *>(data), size);
+				offset += size;
+
+				return;
+			}
+
+			template <typename T>
+			void put(const T value)
+			{
+				bytes(&value, sizeof(value));
+
+				return;
+			}
+
+			void align()
+			{
+				const char zeros[snapshot_alignment] = {0};
+				bytes(zeros, (snapshot_alignment - offset % snapshot_alignment) % snapshot_alignment);
+
+				return;
+			}
+
+			/// Write the pixels of an image, which does not need to be continuous.
+			void image(const cv::Mat & mat)
+			{
+				align();
+				const size_t row_length = mat.cols * mat.elemSize();
+				for (int y = 0; y < mat.rows; y ++)
+				{
+					bytes(mat.ptr(y), row_length);
+				}
+
+				return;
+			}
+
+		private:
+
+			std::ostream & stream;
+			size_t offset;
+	};
+
+	/// Read values from a block of memory, making sure we never read past the end.
+	class SnapshotReader
+	{
+		public:
+
+			SnapshotReader(const uint8_t * d, const size_t s) :
+				data(d),
+				size(s),
+				offset(0)
+			{
+				return;
+			}
+
+			const uint8_t * bytes(const size_t length)
+			{
+				if (length > size - offset)
+				{
+					throw std::invalid_argument("snapshot is truncated");
+				}
+
+				const uint8_t * ptr = data + offset;
+				offset += length;
+
+				return ptr;
+			}
+
+			template <typename T>
+			T get()
+			{
+				T value;
+				std::memcpy(&value, bytes(sizeof(value)), sizeof(value));
+
+				return value;
+			}
+
+			void align()
+			{
+				bytes((snapshot_alignment - offset % snapshot_alignment) % snapshot_alignment);
+
+				return;
+			}
+
+			/// The number of bytes which have not yet been read.
+			size_t remaining() const
+			{
+				return size - offset;
+			}
+
+			/** The number of bytes used by the pixels of an image.  The values come from the snapshot, so they are checked
+			 * against the number of bytes remaining in a way which cannot overflow, before they are used to allocate
+			 * anything.
+			 */
+			size_t image_size(const int rows, const int cols, const int type) const
+			{
+				if (rows <= 0 or cols <= 0 or type < 0 or type >= CV_DEPTH_MAX * CV_CN_MAX)
+				{
+					throw std::invalid_argument("snapshot contains an invalid image");
+				}
+
+				// cols * element size always fits since both are limited to 32 bits
+				const size_t row_length = static_cast<size_t>(cols) * CV_ELEM_SIZE(type);
+				if (row_length > remaining() or static_cast<size_t>(rows) > remaining() / row_length)
+				{
+					throw std::invalid_argument("snapshot is truncated");
+				}
+
+				return static_cast<size_t>(rows) * row_length;
+			}
+
+			/// Get a header which points to the pixels in the snapshot.  Nothing is copied.
+			cv::Mat image(const int rows, const int cols, const int type)
+			{
+				align();
+				const size_t length = image_size(rows, cols, type);
+
+				return cv::Mat(rows, cols, type, const_cast<uint8_t *>(bytes(length)));
+			}
+
+		private:
+
+			const uint8_t * data;
+			const size_t size;
+			size_t offset;
+	};
+
+	void write_polygons(SnapshotWriter & writer, const std::vector<MoveDetect::Handler::Polygon> & polygons)
+	{
+		writer.put<uint64_t>(polygons.size());
+		for (const auto & polygon : polygons)
+		{
+			writer.put<uint64_t>(polygon.size());
+			for (const auto & point : polygon)
+			{
+				writer.put<int32_t>(point.x);
+				writer.put<int32_t>(point.y);
+			}
+		}
+
+		return;
+	}
+
+	std::vector<MoveDetect::Handler::Polygon> read_polygons(SnapshotReader & reader)
+	{
+		// every polygon needs at least 8 bytes, so the count can be checked before anything is allocated
+		const uint64_t number_of_polygons = reader.get<uint64_t>();
+		if (number_of_polygons > reader.remaining() / sizeof(uint64_t))
+		{
+			throw std::invalid_argument("snapshot is truncated");
+		}
+
+		std::vector<MoveDetect::Handler::Polygon> polygons(number_of_polygons);
+		for (auto & polygon : polygons)
+		{
+			const uint64_t number_of_points = reader.get<uint64_t>();
+			if (number_of_points > reader.remaining() / (2 * sizeof(int32_t)))
+			{
+				throw std::invalid_argument("snapshot is truncated");
+			}
+			polygon.reserve(number_of_points);
+			for (uint64_t idx = 0; idx < number_of_points; idx ++)
+			{
+				const int x = reader.get<int32_t>();
+				const int y = reader.get<int32_t>();
+				polygon.emplace_back(x, y);
+			}
+		}
+
+		return polygons;
+	}
+
+	/// Read an OpenCV enum, making sure the value is one of those listed.
+	template <typename T>
+	T read_enum(SnapshotReader & reader, const std::initializer_list<T> valid, const std::string & name)
+	{
+		const int32_t value = reader.get<int32_t>();
+		for (const T v : valid)
+		{
+			if (value == static_cast<int32_t>(v))
+			{
+				return v;
+			}
+		}
+
+		throw std::invalid_argument("snapshot contains an invalid " + name);
+	}
+
+	/// Read a number, making sure it is within the range @p minimum to @p maximum.  NaN is never valid.
+	template <typename T>
+	T read_range(SnapshotReader & reader, const T minimum, const T maximum, const std::string & name)
+	{
+		const T value = reader.get<T>();
+		if (not (value >= minimum and value <= maximum))
+		{
+			throw std::invalid_argument("snapshot contains an invalid " + name);
+		}
+
+		return value;
+	}
+}
+
+
+void MoveDetect::Handler::save(std::ostream & stream) const
+{
+	SnapshotWriter writer(stream);
+
+	writer.bytes(snapshot_magic, sizeof(snapshot_magic));
+	writer.put<uint32_t>(snapshot_version);
+	writer.put<uint32_t>(snapshot_byte_order);
+
+	// configuration
+	writer.put<uint64_t>(key_frame_frequency);
+	writer.put<uint64_t>(number_of_control_frames);
+	writer.put<double>(psnr_threshold);
+	writer.put<double>(thumbnail_ratio);
+	writer.put<int32_t>(thumbnail_size.width);
+	writer.put<int32_t>(thumbnail_size.height);
+	writer.put<uint8_t>(static_cast<uint8_t>(thumbnail_method));
+	writer.put<uint64_t>(thumbnail_row_step);
+	writer.put<uint8_t>(cascade_enabled);
+	writer.put<double>(cascade_ratio);
+	writer.put<double>(cascade_band);
+	writer.put<double>(cascade_psnr_offset);
+	writer.put<uint8_t>(mask_enabled);
+	writer.put<uint8_t>(lazy_evaluation);
+	writer.put<uint8_t>(mask_low_resolution);
+	writer.put<int32_t>(morphology_shape);
+	writer.put<int32_t>(morphology_size);
+	writer.put<int32_t>(morphology_iterations);
+	writer.put<uint64_t>(region_minimum_area);
+	writer.put<int32_t>(line_type);
+	writer.put<uint8_t>(contours_enabled);
+	writer.put<int32_t>(contours_size);
+	writer.put<uint8_t>(bbox_enabled);
+	writer.put<int32_t>(bbox_size);
+	writer.put<uint8_t>(colour_balance_enabled);
+	writer.put<uint64_t>(colour_balance_frequency);
+	writer.put<uint8_t>(instrumentation_enabled);
+	writer.put<uint8_t>(adaptive_enabled);
+	writer.put<uint64_t>(adaptive_maximum_interval);
+	writer.put<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(adaptive_stable_time).count());
+	writer.put<double>(adaptive_psnr_margin);
+	writer.put<uint8_t>(static_cast<uint8_t>(engine));
+	writer.put<double>(running_average_alpha);
+	writer.put<uint8_t>(running_average_variance_enabled);
+	writer.put<double>(running_average_noise_factor);
+	writer.put<uint8_t>(grid_enabled);
+	writer.put<int32_t>(grid_size.width);
+	writer.put<int32_t>(grid_size.height);
+	writer.put<double>(grid_psnr_threshold);
+	write_polygons(writer, regions_of_interest);
+	write_polygons(writer, exclusion_zones);
+
+	// state
+	writer.put<uint64_t>(next_frame_index);
+	writer.put<uint64_t>(next_key_frame);
+	writer.put<uint64_t>(frame_index_with_movement);
+	writer.put<uint8_t>(movement_detected);
+	writer.put<double>(most_recent_psnr_score);
+
+	// control thumbnails, oldest first so they can be inserted in the same order when loading
+	writer.put<int32_t>(control.thumbnail_type());
+	writer.put<int32_t>(control.thumbnail_size().height);
+	writer.put<int32_t>(control.thumbnail_size().width);
+	writer.put<uint64_t>(control.size());
+	for (const auto & [frame_index, thumbnail] : control)
+	{
+		writer.put<uint64_t>(frame_index);
+		writer.image(thumbnail);
+	}
+
+	// running average
+	const bool has_mean		= (background_mean.empty() == false);
+	const bool has_variance	= (background_variance.empty() == false);
+	writer.put<uint8_t>(has_mean);
+	writer.put<uint8_t>(has_variance);
+	if (has_mean)
+	{
+		writer.put<int32_t>(background_mean.type());
+		writer.put<int32_t>(background_mean.rows);
+		writer.put<int32_t>(background_mean.cols);
+		writer.image(background_mean);
+		if (has_variance)
+		{
+			writer.image(background_variance);
+		}
+	}
+
+	if (not stream)
+	{
+		throw std::invalid_argument("failed to write the snapshot");
+	}
+
+	return;
+}
+
+
+void MoveDetect::Handler::save(const std::string & filename) const
+{
+	std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+	if (not ofs)
+	{
+		throw std::invalid_argument("failed to open " + filename);
+	}
+
+	save(ofs);
+
+	return;
+}
+
+
+std::vector<uint8_t> MoveDetect::Handler::save() const
+{
+	std::ostringstream oss(std::ios::binary);
+	save(oss);
+	const std::string str = oss.str();
+
+	return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+
+MoveDetect::Handler & MoveDetect::Handler::load(const uint8_t * data, const size_t size)
+{
+	if (data == nullptr)
+	{
+		throw std::invalid_argument("cannot load a snapshot from a null pointer");
+	}
+
+	SnapshotReader reader(data, size);
+
+	if (std::memcmp(reader.bytes(sizeof(snapshot_magic)), snapshot_magic, sizeof(snapshot_magic)) != 0)
+	{
+		throw std::invalid_argument("not a MoveDetect snapshot");
+	}
+
+	const uint32_t version = reader.get<uint32_t>();
+	if (version != snapshot_version)
+	{
+		throw std::invalid_argument("unsupported snapshot version " + std::to_string(version));
+	}
+
+	if (reader.get<uint32_t>() != snapshot_byte_order)
+	{
+		throw std::invalid_argument("snapshot was saved on a computer with a different byte order");
+	}
+
+	// Everything is read into a new handler, so this one is left untouched if the snapshot is invalid.
+	Handler handler;
+
+	handler.key_frame_frequency					= reader.get<uint64_t>();
+	handler.number_of_control_frames			= reader.get<uint64_t>();
+	handler.psnr_threshold						= reader.get<double>();
+	handler.thumbnail_ratio						= reader.get<double>();
+	handler.thumbnail_size.width				= reader.get<int32_t>();
+	handler.thumbnail_size.height				= reader.get<int32_t>();
+	handler.thumbnail_method					= static_cast<ThumbnailMethod>(reader.get<uint8_t>());
+	handler.thumbnail_row_step					= read_range<uint64_t>(reader, 1, std::numeric_limits<uint64_t>::max(), "thumbnail row step");
+	handler.cascade_enabled						= reader.get<uint8_t>();
+	handler.cascade_ratio						= reader.get<double>();
+	handler.cascade_band						= reader.get<double>();
+	handler.cascade_psnr_offset					= reader.get<double>();
+	handler.mask_enabled						= reader.get<uint8_t>();
+	handler.lazy_evaluation						= reader.get<uint8_t>();
+	handler.mask_low_resolution					= reader.get<uint8_t>();
+	handler.morphology_shape					= read_enum<cv::MorphShapes>(reader, {cv::MORPH_RECT, cv::MORPH_CROSS, cv::MORPH_ELLIPSE}, "morphology shape");
+	handler.morphology_size						= read_range<int32_t>(reader, 1, 255, "morphology size");
+	handler.morphology_iterations				= read_range<int32_t>(reader, 0, 1000, "number of morphology iterations");
+	handler.region_minimum_area					= reader.get<uint64_t>();
+	handler.line_type							= read_enum<cv::LineTypes>(reader, {cv::FILLED, cv::LINE_4, cv::LINE_8, cv::LINE_AA}, "line type");
+	handler.contours_enabled					= reader.get<uint8_t>();
+	handler.contours_size						= read_range<int32_t>(reader, 1, 32767, "contours size");
+	handler.bbox_enabled						= reader.get<uint8_t>();
+	handler.bbox_size							= read_range<int32_t>(reader, 1, 32767, "bounding box size");
+	handler.colour_balance_enabled				= reader.get<uint8_t>();
+	handler.colour_balance_frequency			= reader.get<uint64_t>();
+	handler.instrumentation_enabled				= reader.get<uint8_t>();
+	handler.adaptive_enabled					= reader.get<uint8_t>();
+	handler.adaptive_maximum_interval			= reader.get<uint64_t>();
+	handler.adaptive_stable_time				= std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::nanoseconds(reader.get<int64_t>()));
+	handler.adaptive_psnr_margin				= reader.get<double>();
+	handler.engine								= static_cast<Engine>(reader.get<uint8_t>());
+	handler.running_average_alpha				= read_range<double>(reader, 0.0, 1.0, "running average alpha");
+	handler.running_average_variance_enabled	= reader.get<uint8_t>();
+	handler.running_average_noise_factor		= reader.get<double>();
+	handler.grid_enabled						= reader.get<uint8_t>();
+	handler.grid_size.width						= read_range<int32_t>(reader, 1, std::numeric_limits<int32_t>::max(), "grid size");
+	handler.grid_size.height					= read_range<int32_t>(reader, 1, std::numeric_limits<int32_t>::max(), "grid size");
+	handler.grid_psnr_threshold					= reader.get<double>();
+	handler.regions_of_interest					= read_polygons(reader);
+	handler.exclusion_zones						= read_polygons(reader);
+
+	handler.next_frame_index					= reader.get<uint64_t>();
+	handler.next_key_frame						= reader.get<uint64_t>();
+	handler.frame_index_with_movement			= reader.get<uint64_t>();
+	handler.movement_detected					= reader.get<uint8_t>();
+	handler.most_recent_psnr_score				= reader.get<double>();
+
+	if (handler.engine != Engine::ControlFrames and handler.engine != Engine::RunningAverage)
+	{
+		throw std::invalid_argument("snapshot contains an invalid engine");
+	}
+
+	if (handler.thumbnail_method != ThumbnailMethod::OpenCV and handler.thumbnail_method != ThumbnailMethod::Integer and handler.thumbnail_method != ThumbnailMethod::IntegerFast)
+	{
+		throw std::invalid_argument("snapshot contains an invalid thumbnail method");
+	}
+
+	// the thumbnail size is 0x0 until the first frame has been seen
+	const bool thumbnail_size_is_empty = (handler.thumbnail_size.width == 0 and handler.thumbnail_size.height == 0);
+	if (thumbnail_size_is_empty == false and (handler.thumbnail_size.width <= 0 or handler.thumbnail_size.height <= 0))
+	{
+		throw std::invalid_argument("snapshot contains an invalid thumbnail size");
+	}
+
+	const int type					= reader.get<int32_t>();
+	const int rows					= reader.get<int32_t>();
+	const int cols					= reader.get<int32_t>();
+	const uint64_t number_of_controls	= reader.get<uint64_t>();
+	if (number_of_controls > 0)
+	{
+		// Make sure all the thumbnails are in the snapshot before the ring buffer is allocated.  Each one also has a
+		// frame index.  The padding is not included, so the reads below still check for truncation.
+		const size_t thumbnail_bytes = reader.image_size(rows, cols, type) + sizeof(uint64_t);
+		if (number_of_controls > reader.remaining() / thumbnail_bytes)
+		{
+			throw std::invalid_argument("snapshot is truncated");
+		}
+
+		// Only enough slots for what is in the snapshot.  The next call to detect() resizes the ring buffer to
+		// number_of_control_frames and keeps the most recent thumbnails, so that value is never used to allocate here.
+		handler.control.reserve(number_of_controls, cv::Size(cols, rows), type);
+		for (uint64_t idx = 0; idx < number_of_controls; idx ++)
+		{
+			const size_t frame_index = reader.get<uint64_t>();
+			handler.control.insert(frame_index, reader.image(rows, cols, type));
+		}
+	}
+
+	const bool has_mean		= reader.get<uint8_t>();
+	const bool has_variance	= reader.get<uint8_t>();
+	if (has_mean)
+	{
+		const int mean_type = reader.get<int32_t>();
+		const int mean_rows = reader.get<int32_t>();
+		const int mean_cols = reader.get<int32_t>();
+		if (mean_rows <= 0 or mean_cols <= 0 or CV_MAT_DEPTH(mean_type) != CV_32F)
+		{
+			throw std::invalid_argument("snapshot contains an invalid running average");
+		}
+
+		handler.background_mean = reader.image(mean_rows, mean_cols, mean_type).clone();
+		if (has_variance)
+		{
+			handler.background_variance = reader.image(mean_rows, mean_cols, mean_type).clone();
+		}
+	}
+
+	*this = handler;
+
+	return *this;
+}
+
+
+MoveDetect::Handler & MoveDetect::Handler::load(std::istream & stream)
+{
+	const std::vector<uint8_t> data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+	return load(data.data(), data.size());
+}
+
+
+MoveDetect::Handler & MoveDetect::Handler::load(const std::string & filename)
+{
+	std::ifstream ifs(filename, std::ios::binary);
+	if (not ifs)
+	{
+		throw std::invalid_argument("failed to open " + filename);
+	}
+
+	return load(ifs);
+}
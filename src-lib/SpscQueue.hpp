@@ -0,0 +1,187 @@
+// MoveDetect -- Library to detect whether movement can be detected between two images or video frames.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace MoveDetect
+{
+	/** Bounded single-producer single-consumer queue.  Exactly one thread may push, and exactly one other thread may pop.
+	 *
+	 * @ref try_push() and @ref try_pop() are lock-free and never block.  The blocking @ref push() and @ref pop() spin
+	 * for a short time, and only then go to sleep on a condition variable until the other side makes progress.  The mutex
+	 * is only ever locked when one of the threads needs to sleep or be woken up.
+	 *
+	 * This is used to pass frames between the stages of @ref AsyncHandler.
+	 */
+	template <typename T>
+	class SpscQueue
+	{
+		public:
+
+			/// Constructor.  The capacity is rounded up to the next power of 2.
+			SpscQueue(const size_t minimum_capacity) :
+				head(0),
+				tail(0),
+				waiters(0),
+				closed(false)
+			{
+				size_t capacity = 1;
+				while (capacity < minimum_capacity)
+				{
+					capacity *= 2;
+				}
+				slots.resize(capacity);
+				mask = capacity - 1;
+
+				return;
+			}
+
+			/// Get the maximum number of items which can be stored in the queue.
+			size_t capacity() const
+			{
+				return slots.size();
+			}
+
+			/// Determine if the queue is empty.  The answer may already be out-of-date by the time it is returned.
+			bool empty() const
+			{
+				return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+			}
+
+			/// Add an item to the queue without blocking.  The item is only moved if @p true is returned.  Producer only.
+			bool try_push(T & value)
+			{
+				const size_t t = tail.load(std::memory_order_relaxed);
+				if (t - head.load(std::memory_order_acquire) > mask)
+				{
+					// the queue is full
+					return false;
+				}
+
+				slots[t & mask] = std::move(value);
+				tail.store(t + 1, std::memory_order_release);
+
+				return true;
+			}
+
+			/// Remove an item from the queue without blocking.  Returns @p false if the queue is empty.  Consumer only.
+			bool try_pop(T & value)
+			{
+				const size_t h = head.load(std::memory_order_relaxed);
+				if (h == tail.load(std::memory_order_acquire))
+				{
+					// the queue is empty
+					return false;
+				}
+
+				value = std::move(slots[h & mask]);
+				head.store(h + 1, std::memory_order_release);
+
+				return true;
+			}
+
+			/// Add an item to the queue, waiting for the consumer to make room if the queue is full.  Producer only.
+			void push(T && value)
+			{
+				while (try_push(value) == false)
+				{
+					wait_until([&]{ return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) <= mask; });
+				}
+				notify();
+
+				return;
+			}
+
+			/** Remove an item from the queue, waiting for the producer if the queue is empty.  Consumer only.
+			 *
+			 * @return @p false if the queue was closed and there are no items left.
+			 */
+			bool pop(T & value)
+			{
+				while (try_pop(value) == false)
+				{
+					if (closed.load())
+					{
+						// the producer may have pushed one last item before closing the queue
+						return try_pop(value);
+					}
+					wait_until([&]{ return closed.load() or head.load(std::memory_order_relaxed) != tail.load(std::memory_order_acquire); });
+				}
+				notify();
+
+				return true;
+			}
+
+			/// Tell the consumer that no more items will be pushed.  Items already in the queue can still be popped.
+			void close()
+			{
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					closed = true;
+				}
+				condition.notify_all();
+
+				return;
+			}
+
+		private:
+
+			/// Spin for a short while, then sleep until @p ready returns @p true.
+			template <typename Predicate>
+			void wait_until(Predicate ready)
+			{
+				for (size_t spin = 0; spin < 64; spin ++)
+				{
+					if (ready())
+					{
+						return;
+					}
+					std::this_thread::yield();
+				}
+
+				std::unique_lock<std::mutex> guard(lock);
+				waiters ++;
+				condition.wait(guard, ready);
+				waiters --;
+
+				return;
+			}
+
+			/// Wake up the other thread if it went to sleep.
+			void notify()
+			{
+				// This is a read-modify-write instead of a load so it is ordered with the increment in wait_until():  either
+				// we see that the other thread is waiting, or it sees the new head or tail when it checks the predicate.
+				if (waiters.fetch_add(0) > 0)
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					condition.notify_all();
+				}
+
+				return;
+			}
+
+			std::vector<T> slots;
+			size_t mask;
+
+			/// The next slot to pop.  Only modified by the consumer.
+			alignas(64) std::atomic<size_t> head;
+
+			/// The next slot to push.  Only modified by the producer.
+			alignas(64) std::atomic<size_t> tail;
+
+			alignas(64) std::atomic<size_t> waiters;
+			std::atomic<bool> closed;
+			std::mutex lock;
+			std::condition_variable condition;
+	};
+}
@@ -0,0 +1,61 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "Statistics.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+void MoveDetect::StageStatistics::add(const uint64_t nanoseconds)
+{
+	calls		++;
+	last_ns		= nanoseconds;
+	total_ns	+= nanoseconds;
+	max_ns		= std::max(max_ns, nanoseconds);
+
+	size_t bucket = 0;
+	uint64_t value = nanoseconds;
+	while (value > 1 and bucket + 1 < number_of_buckets)
+	{
+		value >>= 1;
+		bucket ++;
+	}
+	histogram[bucket] ++;
+
+	return;
+}
+
+
+double MoveDetect::StageStatistics::mean_ns() const
+{
+	if (calls == 0)
+	{
+		return 0.0;
+	}
+
+	return static_cast<double>(total_ns) / static_cast<double>(calls);
+}
+
+
+uint64_t MoveDetect::StageStatistics::percentile_ns(const double p) const
+{
+	if (calls == 0)
+	{
+		return 0;
+	}
+
+	const uint64_t target = static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 1.0) * calls));
+	uint64_t cumulative = 0;
+	for (size_t bucket = 0; bucket < number_of_buckets; bucket ++)
+	{
+		cumulative += histogram[bucket];
+		if (cumulative >= target and cumulative > 0)
+		{
+			// upper limit of this bucket, but never more than the longest time actually seen
+			return std::min(max_ns, (uint64_t(2) << bucket) - 1);
+		}
+	}
+
+	return max_ns;
+}
@@ -0,0 +1,131 @@
+// MoveDetect -- Library to detect whether movement can be detected between two images or video frames.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/** Set this to @p 0 when building the library to completely remove the timing code from @ref MoveDetect::Handler.
+ * When compiled in, the instrumentation still needs to be turned on at runtime with
+ * @ref MoveDetect::Handler::instrumentation_enabled.  @see CMake option @p MOVEDETECT_INSTRUMENTATION
+ */
+#ifndef MOVEDETECT_INSTRUMENTATION
+#define MOVEDETECT_INSTRUMENTATION 1
+#endif
+
+
+namespace MoveDetect
+{
+	/// The different stages of work done by @ref Handler for which timings are recorded.  @see @ref Statistics
+	enum class Stage
+	{
+		ColourBalance,	///< Colour balancing the frame.  @see @ref Handler::colour_balance_enabled
+		Thumbnail,		///< Resizing the frame to create the thumbnail.
+		Compare,		///< Comparing the thumbnail against the control thumbnails.
+		Mask,			///< Creating the mask, including the upscale and dilate/erode.
+		Contours,		///< Finding the contours in the mask.
+		BoundingBox,	///< Finding the bounding box in the mask.
+		Regions,		///< Finding the individual motion regions.
+		Output,			///< Drawing the output image.
+		Detect			///< The entire call to @ref Handler::detect(), including all of the stages above that are not lazy.
+	};
+
+	/// Number of values in @ref Stage.
+	const size_t number_of_stages = static_cast<size_t>(Stage::Detect) + 1;
+
+	/// Timing information for a single @ref Stage.
+	struct StageStatistics
+	{
+		/// Number of log2 buckets in @ref histogram.  The last bucket is for anything longer than ~1 second.
+		static const size_t number_of_buckets = 32;
+
+		/// Number of times this stage ran.
+		uint64_t calls = 0;
+
+		/// Duration of the last time this stage ran, in nanoseconds.
+		uint64_t last_ns = 0;
+
+		/// Total time spent in this stage, in nanoseconds.
+		uint64_t total_ns = 0;
+
+		/// Longest time spent in this stage, in nanoseconds.
+		uint64_t max_ns = 0;
+
+		/** Histogram of the durations.  Bucket @p N counts the calls that took between 2^N and 2^(N+1) nanoseconds.
+		 * Bucket @p 0 also includes calls that took less than 1 nanosecond.
+		 */
+		std::array<uint64_t, number_of_buckets> histogram = {};
+
+		/// Record one call to this stage.
+		void add(const uint64_t nanoseconds);
+
+		/// Average duration of a call in nanoseconds.
+		double mean_ns() const;
+
+		/** Approximate percentile in nanoseconds, for example @p 0.99 for p99.  This returns the upper limit of the
+		 * histogram bucket where the percentile falls, so it is never lower than the real value by more than a factor of 2.
+		 */
+		uint64_t percentile_ns(const double p) const;
+	};
+
+	/** Counters and timings recorded by @ref Handler when @ref Handler::instrumentation_enabled is set.
+	 * Take a copy with @ref Handler::snapshot() to export them into a metrics system.
+	 */
+	struct Statistics
+	{
+		/// Timings for each stage.  Index this with @ref Stage, or use @ref stage().
+		std::array<StageStatistics, number_of_stages> stages;
+
+		/// Number of frames passed to @ref Handler::detect(), including skipped frames.
+		uint64_t frames = 0;
+
+		/// Number of frames skipped.  @see @ref Handler::adaptive_enabled
+		uint64_t frames_skipped = 0;
+
+		/// Number of frames where movement was detected.
+		uint64_t frames_with_movement = 0;
+
+		/// Number of thumbnails stored as control frames.
+		uint64_t key_frames_inserted = 0;
+
+		/// Number of control frames examined for the most recent frame before a decision was made.
+		uint64_t last_control_frames_compared = 0;
+
+		/// Total number of control frames examined.
+		uint64_t control_frames_compared = 0;
+
+		/// Number of times the comparison stopped before reaching the end of all the control thumbnails.
+		uint64_t early_exits = 0;
+
+		/** Number of frames decided using only the small thumbnails, without creating the full-size thumbnail.
+		 * @see @ref Handler::cascade_enabled
+		 */
+		uint64_t coarse_decisions = 0;
+
+		/** Number of control frames where the comparison was done by another handler and re-used.
+		 * @see @ref MultiHandler
+		 */
+		uint64_t comparisons_reused = 0;
+
+		/** Estimate of how many times the images owned by the handler had to be allocated or re-allocated, such as the
+		 * control ring buffer, the colour balanced image, the differences, and the zone masks.  Each mask and output image
+		 * created is also counted, since those are always new images.  Temporary buffers used inside OpenCV calls such as
+		 * @p cv::resize() are not counted, so this cannot prove that no memory at all is allocated.  It is meant to spot
+		 * buffers which are unexpectedly re-allocated on every frame:  in steady state without a mask, this should stop
+		 * increasing once the control ring buffer has been allocated.
+		 */
+		uint64_t image_reallocations = 0;
+
+		/// Access the timings for one stage.
+		StageStatistics & stage(const Stage s) { return stages[static_cast<size_t>(s)]; }
+
+		/// Access the timings for one stage.
+		const StageStatistics & stage(const Stage s) const { return stages[static_cast<size_t>(s)]; }
+
+		/// Reset all the counters and timings to zero.
+		void reset() { *this = Statistics(); }
+	};
+}
@@ -0,0 +1,457 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "MoveDetect.hpp"
+#include "BasicHandler.hpp"
+#include "json.hpp"
+#include "parse.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+
+/* Headless benchmark for the MoveDetect library.  The videos are decoded once into memory so that decoding is not part
+ * of the measurements, then psnr(), simple_colour_balance(), and Handler::detect() are timed with several different
+ * configurations.  The results are written as JSON so they can be compared between versions of the library.
+ */
+
+
+typedef std::vector<cv::Mat> Frames;
+typedef std::chrono::steady_clock Clock;
+
+
+struct Measurement
+{
+	std::string name;
+	std::string video;
+	std::string parameters;		// already formatted as JSON key/value pairs
+	std::vector<double> nanoseconds;
+};
+
+
+double percentile(const std::vector<double> & sorted, const double p)
+{
+	if (sorted.empty())
+	{
+		return 0.0;
+	}
+
+	const size_t idx = std::min(sorted.size() - 1, static_cast<size_t>(std::round(p * (sorted.size() - 1))));
+
+	return sorted[idx];
+}
+
+
+std::string to_json(const Measurement & measurement)
+{
+	std::vector<double> sorted = measurement.nanoseconds;
+	std::sort(sorted.begin(), sorted.end());
+
+	double total = 0.0;
+	for (const auto ns : sorted)
+	{
+		total += ns;
+	}
+	const double mean	= sorted.empty() ? 0.0 : total / sorted.size();
+	const double fps	= total > 0.0 ? sorted.size() * 1000000000.0 / total : 0.0;
+
+	std::stringstream ss;
+	ss	<< "{"
+		<< "\"name\":\""		<< json_escape(measurement.name)	<< "\","
+		<< "\"video\":\""		<< json_escape(measurement.video)	<< "\","
+		<< "\"parameters\":{"	<< measurement.parameters			<< "},"
+		<< "\"calls\":"			<< sorted.size()					<< ","
+		<< "\"calls_per_second\":"	<< fps							<< ","
+		<< "\"mean_ns\":"		<< mean								<< ","
+		<< "\"min_ns\":"		<< percentile(sorted, 0.00)			<< ","
+		<< "\"p50_ns\":"		<< percentile(sorted, 0.50)			<< ","
+		<< "\"p90_ns\":"		<< percentile(sorted, 0.90)			<< ","
+		<< "\"p99_ns\":"		<< percentile(sorted, 0.99)			<< ","
+		<< "\"max_ns\":"		<< percentile(sorted, 1.00)
+		<< "}";
+
+	return ss.str();
+}
+
+
+void print_summary(const Measurement & measurement)
+{
+	std::vector<double> sorted = measurement.nanoseconds;
+	std::sort(sorted.begin(), sorted.end());
+
+	double total = 0.0;
+	for (const auto ns : sorted)
+	{
+		total += ns;
+	}
+
+	std::cout
+		<< "-> " << measurement.name << " {" << measurement.parameters << "}: "
+		<< (total > 0.0 ? sorted.size() * 1000000000.0 / total : 0.0) << " calls/sec, "
+		<< "p50=" << (percentile(sorted, 0.50) / 1000.0) << " us, "
+		<< "p99=" << (percentile(sorted, 0.99) / 1000.0) << " us" << std::endl;
+
+	return;
+}
+
+
+/// Get the median from one line of the JSON output.  @throw std::invalid_argument if the value is missing or invalid.
+double p50_from_json(const std::string & json)
+{
+	const std::string key = "\"p50_ns\":";
+	const size_t start = json.find(key);
+	if (start == std::string::npos)
+	{
+		throw std::invalid_argument("missing p50_ns");
+	}
+
+	const size_t value_start	= start + key.size();
+	const size_t value_end		= json.find_first_of(",}", value_start);
+
+	return parse_double(json.substr(value_start, value_end == std::string::npos ? std::string::npos : value_end - value_start));
+}
+
+
+/* The JSON output has one measurement per line.  Everything before "calls" identifies the measurement, which is how the
+ * results are matched when comparing against a previous run.
+ */
+std::map<std::string, double> load_baseline(const std::string & filename)
+{
+	std::map<std::string, double> baseline;
+
+	std::ifstream ifs(filename);
+	std::string line;
+	size_t line_number = 0;
+	while (std::getline(ifs, line))
+	{
+		line_number ++;
+		const size_t key_end = line.find("\"calls\":");
+		if (key_end == std::string::npos)
+		{
+			continue;
+		}
+
+		try
+		{
+			baseline[line.substr(0, key_end)] = p50_from_json(line);
+		}
+		catch (const std::exception & e)
+		{
+			std::cout << "WARNING: skipping line #" << line_number << " in " << filename << ": " << e.what() << std::endl;
+		}
+	}
+
+	return baseline;
+}
+
+
+Frames load_video(const std::string & filename, const size_t max_frames)
+{
+	Frames frames;
+
+	cv::VideoCapture video_input(filename);
+	if (video_input.isOpened() == false)
+	{
+		std::cout << "ERROR: failed to open " << filename << std::endl;
+		return frames;
+	}
+
+	while (frames.size() < max_frames)
+	{
+		cv::Mat frame;
+		video_input >> frame;
+		if (frame.empty())
+		{
+			break;
+		}
+		frames.push_back(frame);
+	}
+
+	return frames;
+}
+
+
+Measurement benchmark_psnr(const std::string & video, const Frames & frames, const double thumbnail_ratio, const size_t repeat)
+{
+	Measurement measurement;
+	measurement.name		= "psnr";
+	measurement.video		= video;
+	measurement.parameters	= "\"thumbnail_ratio\":" + std::to_string(thumbnail_ratio);
+
+	Frames thumbnails;
+	for (const auto & frame : frames)
+	{
+		cv::Mat thumbnail;
+		cv::resize(frame, thumbnail, cv::Size(), thumbnail_ratio, thumbnail_ratio, cv::INTER_AREA);
+		thumbnails.push_back(thumbnail);
+	}
+
+	volatile double sink = 0.0;
+	for (size_t iteration = 0; iteration < repeat; iteration ++)
+	{
+		for (size_t idx = 1; idx < thumbnails.size(); idx ++)
+		{
+			const auto start = Clock::now();
+			sink = sink + MoveDetect::psnr(thumbnails[idx - 1], thumbnails[idx]);
+			const auto end = Clock::now();
+			measurement.nanoseconds.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		}
+	}
+
+	return measurement;
+}
+
+
+Measurement benchmark_colour_balance(const std::string & video, const Frames & frames, const size_t repeat)
+{
+	Measurement measurement;
+	measurement.name		= "simple_colour_balance";
+	measurement.video		= video;
+	measurement.parameters	= "\"width\":" + std::to_string(frames[0].cols) + ",\"height\":" + std::to_string(frames[0].rows);
+
+	for (size_t iteration = 0; iteration < repeat; iteration ++)
+	{
+		for (const auto & frame : frames)
+		{
+			const auto start = Clock::now();
+			cv::Mat output = MoveDetect::simple_colour_balance(frame);
+			const auto end = Clock::now();
+			measurement.nanoseconds.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		}
+	}
+
+	return measurement;
+}
+
+
+Measurement benchmark_detect(const std::string & video, const Frames & frames, const double thumbnail_ratio, const size_t number_of_control_frames, const bool mask, const bool contours_and_bbox, const size_t repeat)
+{
+	Measurement measurement;
+	measurement.name		= "detect";
+	measurement.video		= video;
+	measurement.parameters	=
+		"\"thumbnail_ratio\":"				+ std::to_string(thumbnail_ratio)			+ ","
+		"\"number_of_control_frames\":"		+ std::to_string(number_of_control_frames)	+ ","
+		"\"mask_enabled\":"					+ (mask ? "true" : "false")					+ ","
+		"\"contours_enabled\":"				+ (contours_and_bbox ? "true" : "false")	+ ","
+		"\"bbox_enabled\":"					+ (contours_and_bbox ? "true" : "false");
+
+	for (size_t iteration = 0; iteration < repeat; iteration ++)
+	{
+		// same settings as the test application in main.cpp
+		MoveDetect::Handler handler;
+		handler.key_frame_frequency			= 1;
+		handler.thumbnail_ratio				= thumbnail_ratio;
+		handler.number_of_control_frames	= number_of_control_frames;
+		handler.mask_enabled				= mask;
+		handler.contours_enabled			= contours_and_bbox;
+		handler.bbox_enabled				= contours_and_bbox;
+
+		for (auto frame : frames)
+		{
+			const auto start = Clock::now();
+			handler.detect(frame);
+			const auto end = Clock::now();
+			measurement.nanoseconds.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		}
+	}
+
+	return measurement;
+}
+
+
+Measurement benchmark_basic_detect(const std::string & video, const Frames & frames, const double thumbnail_ratio, const size_t number_of_control_frames, const size_t repeat)
+{
+	Measurement measurement;
+	measurement.name		= "basic_detect";
+	measurement.video		= video;
+	measurement.parameters	=
+		"\"thumbnail_ratio\":"				+ std::to_string(thumbnail_ratio)			+ ","
+		"\"number_of_control_frames\":"		+ std::to_string(number_of_control_frames);
+
+	for (size_t iteration = 0; iteration < repeat; iteration ++)
+	{
+		// same settings as benchmark_detect() without a mask, but everything is chosen at compile time
+		MoveDetect::BasicHandler<3> handler;
+		handler.key_frame_frequency			= 1;
+		handler.thumbnail_ratio				= thumbnail_ratio;
+		handler.number_of_control_frames	= number_of_control_frames;
+
+		for (const auto & frame : frames)
+		{
+			const auto start = Clock::now();
+			handler.detect(frame);
+			const auto end = Clock::now();
+			measurement.nanoseconds.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		}
+	}
+
+	return measurement;
+}
+
+
+int main(int argc, char *argv[])
+{
+	std::cout << "Headless benchmark for the Movement Detection library." << std::endl;
+
+	std::string output_filename		= "movedetect_benchmark.json";
+	size_t max_frames				= 300;
+	size_t repeat					= 3;
+	std::string baseline_filename;
+	double tolerance				= 10.0;
+	std::vector<std::string> videos;
+
+	bool show_usage = false;
+
+	try
+	{
+		for (int idx = 1; idx < argc; idx ++)
+		{
+			const std::string arg = argv[idx];
+			if (arg == "--output" and idx + 1 < argc)
+			{
+				output_filename = argv[++ idx];
+			}
+			else if (arg == "--max-frames" and idx + 1 < argc)
+			{
+				max_frames = parse_size(argv[++ idx]);
+			}
+			else if (arg == "--repeat" and idx + 1 < argc)
+			{
+				repeat = std::max<size_t>(1, parse_size(argv[++ idx]));
+			}
+			else if (arg == "--baseline" and idx + 1 < argc)
+			{
+				baseline_filename = argv[++ idx];
+			}
+			else if (arg == "--tolerance" and idx + 1 < argc)
+			{
+				tolerance = parse_double(argv[++ idx]);
+			}
+			else if (arg.size() > 1 and arg[0] == '-')
+			{
+				show_usage = true;
+				break;
+			}
+			else
+			{
+				videos.push_back(arg);
+			}
+		}
+	}
+	catch (const std::exception & e)
+	{
+		std::cout << "ERROR: " << e.what() << std::endl;
+		show_usage = true;
+	}
+
+	if (show_usage)
+	{
+		std::cout
+			<< "Usage:" << std::endl
+			<< "\t" << argv[0] << " [--output <filename.json>] [--max-frames <n>] [--repeat <n>] [--baseline <previous.json> [--tolerance <percent>]] [<video1> <video2> ...]" << std::endl
+			<< "If no videos are specified, the sample videos in " << MOVEDETECT_SAMPLE_DIR << " are used." << std::endl
+			<< "When a baseline is given, the exit code is 3 if the median latency of any benchmark is more than" << std::endl
+			<< "<percent> slower than in the baseline.  The default tolerance is 10%." << std::endl;
+		return 1;
+	}
+
+	if (videos.empty())
+	{
+		videos.push_back(MOVEDETECT_SAMPLE_DIR "/movement_test_01.m4v");
+		videos.push_back(MOVEDETECT_SAMPLE_DIR "/movement_test_02.m4v");
+	}
+
+	std::vector<Measurement> measurements;
+
+	for (const auto & video : videos)
+	{
+		const Frames frames = load_video(video, max_frames);
+		if (frames.size() < 2)
+		{
+			std::cout << "ERROR: not enough frames in " << video << std::endl;
+			continue;
+		}
+
+		std::cout
+			<< ""																	<< std::endl
+			<< "Input video .......... " << video									<< std::endl
+			<< "Frames loaded ........ " << frames.size()							<< std::endl
+			<< "Dimensions ........... " << frames[0].cols << "x" << frames[0].rows	<< std::endl;
+
+		for (const double ratio : {0.05, 0.25})
+		{
+			measurements.push_back(benchmark_psnr(video, frames, ratio, repeat));
+			print_summary(measurements.back());
+		}
+
+		measurements.push_back(benchmark_colour_balance(video, frames, repeat));
+		print_summary(measurements.back());
+
+		for (const double ratio : {0.05, 0.25})
+		{
+			for (const size_t controls : {4, 10})
+			{
+				measurements.push_back(benchmark_detect(video, frames, ratio, controls, false, false, repeat));
+				print_summary(measurements.back());
+				measurements.push_back(benchmark_detect(video, frames, ratio, controls, true, false, repeat));
+				print_summary(measurements.back());
+				measurements.push_back(benchmark_detect(video, frames, ratio, controls, true, true, repeat));
+				print_summary(measurements.back());
+				measurements.push_back(benchmark_basic_detect(video, frames, ratio, controls, repeat));
+				print_summary(measurements.back());
+			}
+		}
+	}
+
+	std::ofstream ofs(output_filename);
+	ofs << "{\"benchmarks\":[" << std::endl;
+	for (size_t idx = 0; idx < measurements.size(); idx ++)
+	{
+		ofs << to_json(measurements[idx]) << (idx + 1 < measurements.size() ? "," : "") << std::endl;
+	}
+	ofs << "]}" << std::endl;
+
+	std::cout << "-> results saved to " << output_filename << std::endl;
+
+	if (measurements.empty())
+	{
+		return 2;
+	}
+
+	if (baseline_filename.empty() == false)
+	{
+		const auto baseline = load_baseline(baseline_filename);
+		size_t regressions = 0;
+
+		for (const auto & measurement : measurements)
+		{
+			const std::string json = to_json(measurement);
+			const auto iter = baseline.find(json.substr(0, json.find("\"calls\":")));
+			if (iter == baseline.end() or iter->second <= 0.0)
+			{
+				continue;
+			}
+
+			const double previous	= iter->second;
+			const double current	= p50_from_json(json);
+			const double change		= 100.0 * (current - previous) / previous;
+			if (change > tolerance)
+			{
+				regressions ++;
+				std::cout << "REGRESSION: " << measurement.name << " {" << measurement.parameters << "} p50 is " << change << "% slower" << std::endl;
+			}
+		}
+
+		std::cout << "-> compared against " << baseline_filename << ": " << regressions << " regression(s)" << std::endl;
+		if (regressions > 0)
+		{
+			return 3;
+		}
+	}
+
+	return 0;
+}
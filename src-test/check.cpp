@@ -0,0 +1,215 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "MoveDetect.hpp"
+#include <iostream>
+#include <sstream>
+
+
+/* Headless checks which compare the fast paths in the library against the OpenCV calls they replace.  Every failure is
+ * written to STDOUT and the exit code is non-zero if anything failed, so this can be run by "ctest" after each build.
+ */
+
+
+size_t failures = 0;
+
+
+void check(const bool condition, const std::string & description)
+{
+	if (condition == false)
+	{
+		std::cout << "FAILED: " << description << std::endl;
+		failures ++;
+	}
+
+	return;
+}
+
+
+/// A random binary mask where roughly 1 pixel in 10 is set, so there are plenty of gaps for the morphology to close.
+cv::Mat random_mask(cv::RNG & rng, const cv::Size & size)
+{
+	cv::Mat mask(size, CV_8UC1);
+	rng.fill(mask, cv::RNG::UNIFORM, 0, 256);
+	cv::threshold(mask, mask, 230.0, 255.0, cv::THRESH_BINARY);
+
+	return mask;
+}
+
+
+/* When the kernel is a square with an odd size, Handler::close_mask() replaces the dilate/erode loop with a single large
+ * square kernel.  Compare it against the loop it replaced, including images with an odd or even number of rows and
+ * columns, and images which are a single row or column.  Even kernel sizes still use the loop, but are included so a
+ * change to which sizes use the fast path cannot go unnoticed.
+ */
+void check_close_mask()
+{
+	std::cout << "Comparing Handler::close_mask() with cv::dilate() and cv::erode()..." << std::endl;
+
+	const std::vector<cv::Size> sizes =
+	{
+		{64, 48},
+		{63, 47},
+		{64, 47},
+		{63, 48},
+		{1, 1},
+		{37, 1},
+		{1, 29},
+		{200, 1}
+	};
+
+	cv::RNG rng(20211015);
+	MoveDetect::Handler handler;
+	handler.morphology_shape = cv::MORPH_RECT;
+
+	for (const auto & size : sizes)
+	{
+		for (const int morphology_size : {1, 2, 3, 4, 5, 7})
+		{
+			handler.morphology_size = morphology_size;
+			const cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(morphology_size, morphology_size));
+
+			for (int iterations = 0; iterations <= 10; iterations ++)
+			{
+				const cv::Mat mask = random_mask(rng, size);
+
+				cv::Mat dilated;
+				cv::dilate(mask, dilated, kernel, cv::Point(-1, -1), iterations);
+				cv::Mat expected;
+				cv::erode(dilated, expected, kernel, cv::Point(-1, -1), iterations);
+
+				const cv::Mat closed = handler.close_mask(mask, iterations);
+
+				std::stringstream ss;
+				ss << "close_mask() image=" << size.width << "x" << size.height << " kernel=" << morphology_size << " iterations=" << iterations;
+				check(closed.size() == expected.size() and closed.type() == expected.type() and cv::norm(closed, expected, cv::NORM_INF) == 0.0, ss.str());
+			}
+		}
+	}
+
+	return;
+}
+
+
+/// A random image, which is the worst case for any difference in how the blocks of pixels are averaged.
+cv::Mat random_image(cv::RNG & rng, const cv::Size & size, const int type)
+{
+	cv::Mat image(size, type);
+	rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+
+	return image;
+}
+
+
+/** An image where neighbouring pixels never differ by more than a small amount, similar to most of a real video frame.
+ * When the blocks are not a whole number of pixels, the integer sums and @p cv::INTER_AREA average slightly different
+ * areas, which only changes the result by a fraction of the difference between neighbouring pixels.
+ */
+cv::Mat smooth_image(const cv::Size & size, const int type)
+{
+	cv::Mat image(size, type);
+	for (int y = 0; y < image.rows; y ++)
+	{
+		uint8_t * row = image.ptr<uint8_t>(y);
+		for (int x = 0; x < image.cols; x ++)
+		{
+			for (int c = 0; c < image.channels(); c ++)
+			{
+				// a gradient of 1 level every 16 pixels down, and a steeper one across for the other channels, which goes
+				// back down once it reaches 255 instead of wrapping around to 0
+				const int level = (x * (c + 1) + y) / 16 % 510;
+				row[x * image.channels() + c] = static_cast<uint8_t>(level < 256 ? level : 509 - level);
+			}
+		}
+	}
+
+	return image;
+}
+
+
+/* The Integer and IntegerFast thumbnails should be within 1 of cv::resize() with cv::INTER_AREA.  With random images this
+ * is only true when the image is an exact multiple of the thumbnail size, and when every row is used.  Otherwise the
+ * blocks cover slightly different pixels, so smooth images are used instead.  The bands of rows are processed with
+ * cv::parallel_for_(), so the thumbnails must also be identical regardless of the number of threads.
+ */
+void check_thumbnails()
+{
+	std::cout << "Comparing the integer thumbnails with cv::resize()..." << std::endl;
+
+	struct Case
+	{
+		cv::Size image_size;
+		cv::Size thumbnail_size;
+		bool exact_multiple;
+	};
+	const std::vector<Case> cases =
+	{
+		{{640, 480},	{160, 120},	true	},
+		{{640, 480},	{320, 240},	true	},
+		{{641, 481},	{160, 120},	false	},
+		{{640, 480},	{100, 75},	false	},
+		{{1280, 720},	{427, 240},	false	},
+		{{37, 1},		{5, 1},		false	},
+		{{1, 29},		{1, 4},		false	}
+	};
+
+	const int original_threads = cv::getNumThreads();
+	cv::RNG rng(20211016);
+
+	for (const auto & c : cases)
+	{
+		for (const int type : {CV_8UC1, CV_8UC3})
+		{
+			for (const auto method : {MoveDetect::ThumbnailMethod::Integer, MoveDetect::ThumbnailMethod::IntegerFast})
+			{
+				for (const size_t row_step : {1, 2, 3})
+				{
+					MoveDetect::Handler handler;
+					handler.thumbnail_size		= c.thumbnail_size;
+					handler.thumbnail_method	= method;
+					handler.thumbnail_row_step	= row_step;
+
+					const bool every_row = (method == MoveDetect::ThumbnailMethod::Integer or row_step == 1);
+					const cv::Mat image = (c.exact_multiple and every_row ? random_image(rng, c.image_size, type) : smooth_image(c.image_size, type));
+
+					std::stringstream ss;
+					ss	<< "thumbnail image=" << c.image_size.width << "x" << c.image_size.height
+						<< " thumbnail=" << c.thumbnail_size.width << "x" << c.thumbnail_size.height
+						<< " channels=" << image.channels()
+						<< " method=" << (method == MoveDetect::ThumbnailMethod::Integer ? "Integer" : "IntegerFast")
+						<< " row_step=" << row_step;
+
+					cv::setNumThreads(1);
+					const cv::Mat thumbnail = handler.create_thumbnail(image);
+
+					cv::Mat expected;
+					cv::resize(image, expected, c.thumbnail_size, 0, 0, cv::INTER_AREA);
+					check(thumbnail.size() == expected.size() and thumbnail.type() == expected.type() and cv::norm(thumbnail, expected, cv::NORM_INF) <= 1.0, ss.str() + " differs from cv::resize()");
+
+					for (const int threads : {2, 4, 8})
+					{
+						cv::setNumThreads(threads);
+						const cv::Mat parallel = handler.create_thumbnail(image);
+						check(cv::norm(thumbnail, parallel, cv::NORM_INF) == 0.0, ss.str() + " differs with " + std::to_string(threads) + " threads");
+					}
+				}
+			}
+		}
+	}
+
+	cv::setNumThreads(original_threads);
+
+	return;
+}
+
+
+int main()
+{
+	check_close_mask();
+	check_thumbnails();
+
+	std::cout << (failures == 0 ? "All checks passed." : "Some checks failed.") << std::endl;
+
+	return (failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,35 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+
+/// Escape a string so it can be written between double quotes in a JSON file.
+inline std::string json_escape(const std::string & str)
+{
+	std::string output;
+	for (const char c : str)
+	{
+		if (c == '"' or c == '\\')
+		{
+			output += '\\';
+			output += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char buffer[8];
+			std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+			output += buffer;
+		}
+		else
+		{
+			output += c;
+		}
+	}
+
+	return output;
+}
@@ -3,6 +3,7 @@
 // MIT license applies.  See "license.txt" for details.
 
 #include "MoveDetect.hpp"
+#include "Recorder.hpp"
 
 
 int main(int argc, char *argv[])
@@ -27,6 +28,7 @@ int main(int argc, char *argv[])
 		}
 
 		const bool save_output_video	= false;
+		const bool save_movement_clips	= false;
 		const double zoom_factor		= 0.85;
 		const double input_fps			= video_input.get(cv::VideoCaptureProperties::CAP_PROP_FPS			);
 		const double original_width		= video_input.get(cv::VideoCaptureProperties::CAP_PROP_FRAME_WIDTH	);
@@ -84,6 +86,16 @@ int main(int argc, char *argv[])
 			video_output.open("output_" + std::to_string(std::time(nullptr)) + ".mp4", cv::VideoWriter::fourcc('m', 'p', '4', 'v'), input_fps, mat.size());
 		}
 
+		// only the frames with movement and a few seconds before and after are saved, on a background thread
+		std::unique_ptr<MoveDetect::Recorder> recorder;
+		if (save_movement_clips)
+		{
+			recorder.reset(new MoveDetect::Recorder);
+			recorder->fps				= input_fps;
+			recorder->pre_roll_frames	= std::round(3.0 * input_fps);
+			recorder->post_roll_frames	= std::round(3.0 * input_fps);
+		}
+
 		const std::chrono::high_resolution_clock::duration		duration				= std::chrono::nanoseconds(frame_length_ns);
 		const std::chrono::high_resolution_clock::time_point	start_time				= std::chrono::high_resolution_clock::now();
 		std::chrono::high_resolution_clock::time_point			next_frame_time_point	= start_time + duration;
@@ -120,6 +132,11 @@ int main(int argc, char *argv[])
 				video_output.write(mat);
 			}
 
+			if (recorder)
+			{
+				recorder->add(mat, movement_detection);
+			}
+
 //			cv::imwrite("frame_" + std::to_string(frame_index) + ".png", mat, {cv::ImwriteFlags::IMWRITE_PNG_COMPRESSION, 7});
 //			cv::imwrite("frame_" + std::to_string(frame_index) + ".jpg", mat, {cv::ImwriteFlags::IMWRITE_JPEG_QUALITY, 70});
 
@@ -141,6 +158,11 @@ int main(int argc, char *argv[])
 			frame_index ++;
 		}
 
+		if (recorder)
+		{
+			recorder->finish();
+		}
+
 		const std::chrono::high_resolution_clock::time_point end_time = std::chrono::high_resolution_clock::now();
 
 		std::cout
@@ -0,0 +1,56 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+
+/// Parse a command-line value.  The whole string must be a number.  @throw std::invalid_argument if it is not.
+inline size_t parse_size(const std::string & str)
+{
+	size_t pos = 0;
+	size_t value = 0;
+	try
+	{
+		value = std::stoul(str, &pos);
+	}
+	catch (...)
+	{
+		// not a number, or out of range
+		pos = 0;
+	}
+
+	if (pos == 0 or pos != str.size() or str.find('-') != std::string::npos)
+	{
+		throw std::invalid_argument("invalid number \"" + str + "\"");
+	}
+
+	return value;
+}
+
+
+/// @see @ref parse_size()
+inline double parse_double(const std::string & str)
+{
+	size_t pos = 0;
+	double value = 0;
+	try
+	{
+		value = std::stod(str, &pos);
+	}
+	catch (...)
+	{
+		// not a number, or out of range
+		pos = 0;
+	}
+
+	if (pos == 0 or pos != str.size())
+	{
+		throw std::invalid_argument("invalid number \"" + str + "\"");
+	}
+
+	return value;
+}
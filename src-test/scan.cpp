@@ -0,0 +1,362 @@
+// MoveDetect - C++ library to detect movement.
+// Copyright 2021 Stephane Charette <stephanecharette@gmail.com>
+// MIT license applies.  See "license.txt" for details.
+
+#include "MoveDetect.hpp"
+#include "IntervalTracker.hpp"
+#include "SpscQueue.hpp"
+#include "json.hpp"
+#include "parse.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+
+/* Headless batch scanner for recorded video.  Many files are scanned at the same time, each one with its own Handler,
+ * using a fixed number of worker threads.  Each worker also starts a decode thread for the file it is scanning, so
+ * decoding the next frames overlaps with detecting movement in the current frame.  There is no GUI and no pacing, so
+ * the files are processed as fast as the decoder allows.
+ *
+ * Each interval with movement is written to STDOUT as a single line of JSON as soon as the interval ends, so the output
+ * can be streamed into another tool.  Progress, errors, and the final summary are written to STDERR.
+ */
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+struct Settings
+{
+	size_t threads				= std::max(1u, std::thread::hardware_concurrency());
+	size_t queue_size			= 16;
+	double psnr_threshold		= 0.0;
+	double thumbnail_ratio		= 0.0;
+	size_t key_frame_frequency	= 0;
+};
+
+
+std::mutex output_lock;
+std::atomic<size_t> total_frames(0);
+std::atomic<size_t> total_intervals(0);
+std::atomic<size_t> failed_files(0);
+
+
+std::string json_number(const double value)
+{
+	if (std::isfinite(value) == false)
+	{
+		// JSON has no representation for infinity or NaN
+		return "null";
+	}
+
+	std::stringstream ss;
+	ss << value;
+
+	return ss.str();
+}
+
+
+void write_interval(const std::string & filename, const double fps, const MoveDetect::MotionInterval & interval)
+{
+	std::stringstream ss;
+	ss	<< "{"
+		<< "\"file\": \""		<< json_escape(filename)				<< "\", "
+		<< "\"start_frame\": "	<< interval.start_frame					<< ", "
+		<< "\"end_frame\": "	<< interval.end_frame					<< ", "
+		<< "\"peak_frame\": "	<< interval.peak_frame					<< ", "
+		<< "\"start_time\": "	<< json_number(interval.start_frame / fps)	<< ", "
+		<< "\"end_time\": "		<< json_number(interval.end_frame / fps)	<< ", "
+		<< "\"min_psnr\": "		<< json_number(interval.min_psnr)		<< ", "
+		<< "\"max_psnr\": "		<< json_number(interval.max_psnr)
+		<< "}";
+
+	std::lock_guard<std::mutex> guard(output_lock);
+	std::cout << ss.str() << std::endl;
+	total_intervals ++;
+
+	return;
+}
+
+
+void write_error(const std::string & filename, const std::string & message)
+{
+	std::lock_guard<std::mutex> guard(output_lock);
+	std::cerr << "ERROR: " << filename << ": " << message << std::endl;
+
+	return;
+}
+
+
+/// @return @p false if the file could not be scanned completely.
+bool scan_file(const std::string & filename, const Settings & settings)
+{
+	cv::VideoCapture video(filename);
+	if (video.isOpened() == false)
+	{
+		write_error(filename, "failed to open the video");
+		return false;
+	}
+
+	double fps = video.get(cv::VideoCaptureProperties::CAP_PROP_FPS);
+	if (std::isfinite(fps) == false or fps <= 0.0)
+	{
+		fps = 30.0;
+	}
+
+	// The decoder runs on its own thread and stays a few frames ahead.  The frames are moved through the queue, so
+	// every frame is a new image and the handler can safely keep a reference to the previous one.
+	MoveDetect::SpscQueue<cv::Mat> queue(settings.queue_size);
+	std::exception_ptr decoder_exception;
+	std::thread decoder([&]
+		{
+			try
+			{
+				cv::Mat frame;
+				while (video.read(frame))
+				{
+					queue.push(std::move(frame));
+					frame = cv::Mat();
+				}
+			}
+			catch (...)
+			{
+				decoder_exception = std::current_exception();
+			}
+			queue.close();
+		});
+
+	MoveDetect::Handler handler;
+	handler.lazy_evaluation	= true;
+	handler.mask_enabled	= false;
+	if (settings.psnr_threshold > 0.0)
+	{
+		handler.psnr_threshold = settings.psnr_threshold;
+	}
+	if (settings.thumbnail_ratio > 0.0)
+	{
+		handler.thumbnail_ratio = settings.thumbnail_ratio;
+	}
+	if (settings.key_frame_frequency > 0)
+	{
+		handler.key_frame_frequency = settings.key_frame_frequency;
+	}
+
+	MoveDetect::IntervalTracker tracker;
+	size_t frames = 0;
+	bool success = true;
+
+	try
+	{
+		cv::Mat frame;
+		while (queue.pop(frame))
+		{
+			handler.detect(frame);
+			frames ++;
+
+			if (tracker.add(handler))
+			{
+				write_interval(filename, fps, tracker.interval());
+			}
+		}
+
+		if (tracker.finish())
+		{
+			write_interval(filename, fps, tracker.interval());
+		}
+	}
+	catch (...)
+	{
+		success = false;
+		try
+		{
+			throw;
+		}
+		catch (const std::exception & e)
+		{
+			write_error(filename, e.what());
+		}
+		catch (...)
+		{
+			write_error(filename, "unknown error after " + std::to_string(frames) + " frames");
+		}
+
+		// the decoder may be waiting for room in the queue
+		cv::Mat frame;
+		while (queue.pop(frame))
+		{
+		}
+	}
+
+	decoder.join();
+	total_frames += frames;
+
+	if (decoder_exception)
+	{
+		success = false;
+		try
+		{
+			std::rethrow_exception(decoder_exception);
+		}
+		catch (const std::exception & e)
+		{
+			write_error(filename, std::string("decoding failed after ") + std::to_string(frames) + " frames: " + e.what());
+		}
+		catch (...)
+		{
+			write_error(filename, "decoding failed after " + std::to_string(frames) + " frames");
+		}
+	}
+
+	return success;
+}
+
+
+std::vector<std::string> find_videos(const std::vector<std::string> & arguments)
+{
+	const std::vector<std::string> extensions = {".avi", ".m4v", ".mkv", ".mov", ".mp4", ".mpg", ".ts", ".webm"};
+
+	std::vector<std::string> videos;
+	for (const auto & arg : arguments)
+	{
+		if (std::filesystem::is_directory(arg) == false)
+		{
+			// files are used as-is, even if the extension is not recognized
+			videos.push_back(arg);
+			continue;
+		}
+
+		std::vector<std::string> files;
+		for (const auto & entry : std::filesystem::directory_iterator(arg))
+		{
+			std::string extension = entry.path().extension().string();
+			std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+			if (entry.is_regular_file() and std::find(extensions.begin(), extensions.end(), extension) != extensions.end())
+			{
+				files.push_back(entry.path().string());
+			}
+		}
+		std::sort(files.begin(), files.end());
+		videos.insert(videos.end(), files.begin(), files.end());
+	}
+
+	return videos;
+}
+
+
+int main(int argc, char *argv[])
+{
+	std::cerr << "Headless batch scanner for the Movement Detection library." << std::endl;
+
+	Settings settings;
+	std::vector<std::string> arguments;
+
+	bool show_usage = false;
+
+	try
+	{
+		for (int idx = 1; idx < argc; idx ++)
+		{
+			const std::string arg = argv[idx];
+			if (arg == "--threads" and idx + 1 < argc)
+			{
+				settings.threads = std::max<size_t>(1, parse_size(argv[++ idx]));
+			}
+			else if (arg == "--queue" and idx + 1 < argc)
+			{
+				settings.queue_size = std::max<size_t>(1, parse_size(argv[++ idx]));
+			}
+			else if (arg == "--threshold" and idx + 1 < argc)
+			{
+				settings.psnr_threshold = parse_double(argv[++ idx]);
+			}
+			else if (arg == "--thumbnail-ratio" and idx + 1 < argc)
+			{
+				settings.thumbnail_ratio = parse_double(argv[++ idx]);
+			}
+			else if (arg == "--key-frame-frequency" and idx + 1 < argc)
+			{
+				settings.key_frame_frequency = parse_size(argv[++ idx]);
+			}
+			else if (arg.size() > 1 and arg[0] == '-')
+			{
+				show_usage = true;
+				break;
+			}
+			else
+			{
+				arguments.push_back(arg);
+			}
+		}
+	}
+	catch (const std::exception & e)
+	{
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		show_usage = true;
+	}
+
+	if (show_usage or arguments.empty())
+	{
+		std::cerr
+			<< "Usage:" << std::endl
+			<< "\t" << argv[0] << " [--threads <n>] [--queue <frames>] [--threshold <psnr>] [--thumbnail-ratio <ratio>] [--key-frame-frequency <n>] <video or directory> [...]" << std::endl
+			<< "Directories are not searched recursively.  Each interval with movement is written to STDOUT as one line of JSON." << std::endl
+			<< "The default number of threads is the number of cores, and each thread also uses a separate decode thread." << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> videos;
+	try
+	{
+		videos = find_videos(arguments);
+	}
+	catch (const std::exception & e)
+	{
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	// The files are scanned in parallel, so OpenCV should not also try to use every core for each individual frame.
+	cv::setNumThreads(1);
+
+	const size_t number_of_workers = std::min(settings.threads, videos.size());
+	std::cerr << "Scanning " << videos.size() << " video" << (videos.size() == 1 ? "" : "s") << " using " << number_of_workers << " thread" << (number_of_workers == 1 ? "" : "s") << "." << std::endl;
+
+	const auto start = Clock::now();
+
+	// each worker takes the next file which has not yet been scanned
+	std::atomic<size_t> next_video(0);
+	std::vector<std::thread> workers;
+	for (size_t idx = 0; idx < number_of_workers; idx ++)
+	{
+		workers.emplace_back([&]
+			{
+				for (size_t video_index = next_video ++; video_index < videos.size(); video_index = next_video ++)
+				{
+					if (scan_file(videos[video_index], settings) == false)
+					{
+						failed_files ++;
+					}
+				}
+			});
+	}
+	for (auto & worker : workers)
+	{
+		worker.join();
+	}
+
+	const double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count() / 1000.0;
+
+	std::cerr
+		<< "Scanned " << total_frames << " frames from " << videos.size() - failed_files << " of " << videos.size() << " videos"
+		<< " in " << seconds << " seconds (" << (seconds > 0.0 ? total_frames / seconds : 0.0) << " FPS)"
+		<< ", found " << total_intervals << " interval" << (total_intervals == 1 ? "" : "s") << " with movement." << std::endl;
+
+	return (failed_files > 0 ? 2 : 0);
+}